@@ -18,6 +18,8 @@ limitations under the License. */
 #include <utility>
 #include <stdexcept>
 #include <tuple>
+#include <vector>
+#include <algorithm>
 
 #include "General.h"
 #include "TileId.h"
@@ -74,7 +76,53 @@ inline bool operator==(Area const& self, Area const& other)
  */
 inline bool areaContainsTile(Area const& haystack, TileId const& needle)
 {
-  bool const inArea = needle.coord >= haystack.leftTop && needle.coord <= haystack.rightBottom;
+  // the coordinates have to be compared separately, TileCoordinate's operator<= compares them lexicographically
+  bool const inArea = haystack.leftTop.x <= needle.coord.x && needle.coord.x <= haystack.rightBottom.x &&
+                      haystack.leftTop.y <= needle.coord.y && needle.coord.y <= haystack.rightBottom.y;
   bool const corresponds = haystack.center.tileServer == needle.tileServer && haystack.center.zoom == needle.zoom;
   return inArea && corresponds;
 }
+
+/**
+ * Extend the @p area so that it consists of whole tiles of the zoom level above, i.e. so that its tiles exactly cover
+ * the tiles from `leftTop >> 1` to `rightBottom >> 1` at zoom level `center.zoom - 1`.
+ *
+ * @note The zoom level of the @p area has to be positive.
+ */
+inline Area alignToParent(Area area)
+{
+  // there is an even number of tiles per axis, so the extended area stays inside the world
+  area.leftTop = { area.leftTop.x & ~1, area.leftTop.y & ~1 };
+  area.rightBottom = { area.rightBottom.x | 1, area.rightBottom.y | 1 };
+  return area;
+}
+
+/**
+ * Squared distance of the tile at @p coord to the center of @p area, in tiles
+ */
+inline int distanceToCenter(Area const& area, TileCoordinate const& coord)
+{
+  int const dx = coord.x - area.center.coord.x;
+  int const dy = coord.y - area.center.coord.y;
+  return dx * dx + dy * dy;
+}
+
+/**
+ * All tiles of the @p area, ordered by their distance to the area's center (nearest first)
+ */
+inline std::vector<TileId> areaTilesCenterOut(Area const& area)
+{
+  std::vector<TileId> tiles;
+  for (int x = area.leftTop.x; x <= area.rightBottom.x; ++x)
+  {
+    for (int y = area.leftTop.y; y <= area.rightBottom.y; ++y)
+    {
+      tiles.push_back({ area.center.tileServer, { x, y }, area.center.zoom });
+    }
+  }
+
+  std::stable_sort(tiles.begin(), tiles.end(), [&area](TileId const& a, TileId const& b) {
+    return distanceToCenter(area, a.coord) < distanceToCenter(area, b.coord);
+  });
+  return tiles;
+}
@@ -0,0 +1,136 @@
+/* Copyright 2018-2019 TomTom N.V.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License. */
+
+#include "AtlasPagePool.h"
+
+#include <algorithm>
+#include <iterator>
+#include <string>
+
+#include <OGRE/OgreMaterialManager.h>
+#include <OGRE/OgrePixelFormat.h>
+#include <OGRE/OgreTechnique.h>
+#include <OGRE/OgreTextureManager.h>
+
+namespace
+{
+/**
+ * Generate a different name each call
+ */
+std::string uniqueName(std::string const& prefix)
+{
+  static int count = 0;
+  ++count;
+  return prefix + std::to_string(count);
+}
+}  // namespace
+
+std::size_t AtlasPage::byteCount() const
+{
+  std::size_t const pixelBytes = Ogre::PixelUtil::getNumElemBytes(texture->getFormat());
+  std::size_t bytes = 0;
+  for (std::size_t level = 0; level <= texture->getNumMipmaps(); ++level)
+  {
+    std::size_t const width = std::max<std::size_t>(1, texture->getWidth() >> level);
+    std::size_t const height = std::max<std::size_t>(1, texture->getHeight() >> level);
+    bytes += width * height * pixelBytes;
+  }
+  return bytes;
+}
+
+AtlasPagePool::~AtlasPagePool()
+{
+  for (AtlasPage const& page : free_)
+  {
+    destroy(page);
+  }
+}
+
+AtlasPage AtlasPagePool::acquire(int width, int height, int mipmapLevels)
+{
+  ++used_;
+  usedHighWatermark_ = std::max(usedHighWatermark_, used_);
+
+  // prefer the most recently returned page, whose texture is most likely still resident on the GPU
+  auto const it = std::find_if(free_.rbegin(), free_.rend(), [&](AtlasPage const& page) {
+    return static_cast<int>(page.texture->getWidth()) == width &&
+           static_cast<int>(page.texture->getHeight()) == height &&
+           static_cast<int>(page.texture->getNumMipmaps()) == mipmapLevels;
+  });
+  if (it != free_.rend())
+  {
+    AtlasPage page = *it;
+    free_.erase(std::next(it).base());
+    freeBytes_ -= page.byteCount();
+    usedBytes_ += page.byteCount();
+    ++reused_;
+    return page;
+  }
+
+  Ogre::String const res_group = Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME;
+  AtlasPage page;
+
+  // QImage::Format_RGB32 is 0xffRRGGBB in native byte order, just like PF_X8R8G8B8. The mipmaps are uploaded per cell
+  // by TileAtlas, so they must not be generated from the whole page (TU_DEFAULT includes TU_AUTOMIPMAP), which would
+  // overwrite them and blend the cells across their gutters.
+  page.texture = Ogre::TextureManager::getSingleton().createManual(uniqueName("satellite_atlas_"), res_group,
+                                                                    Ogre::TEX_TYPE_2D, width, height, mipmapLevels,
+                                                                    Ogre::PF_X8R8G8B8, Ogre::TU_STATIC_WRITE_ONLY);
+
+  page.material = Ogre::MaterialManager::getSingleton().create(uniqueName("satellite_material_"), res_group);
+  page.material->setReceiveShadows(false);
+  page.material->getTechnique(0)->setLightingEnabled(false);
+  page.material->setDepthBias(-16.0f, 0.0f);
+  page.material->setCullingMode(Ogre::CULL_NONE);
+  page.material->setDepthWriteEnabled(false);
+
+  Ogre::TextureUnitState* tex_unit = page.material->getTechnique(0)->getPass(0)->createTextureUnitState();
+  tex_unit->setTextureName(page.texture->getName());
+  tex_unit->setTextureFiltering(mipmapLevels > 0 ? Ogre::TFO_TRILINEAR : Ogre::TFO_BILINEAR);
+  tex_unit->setTextureAddressingMode(Ogre::TextureUnitState::TAM_CLAMP);
+
+  usedBytes_ += page.byteCount();
+  ++created_;
+  return page;
+}
+
+void AtlasPagePool::release(AtlasPage page)
+{
+  --used_;
+  usedBytes_ -= page.byteCount();
+  freeBytes_ += page.byteCount();
+  free_.push_back(std::move(page));
+  trim();
+}
+
+AtlasPagePoolStats AtlasPagePool::stats() const
+{
+  return { used_, usedHighWatermark_, free_.size(), usedBytes_ + freeBytes_, created_, reused_ };
+}
+
+void AtlasPagePool::trim()
+{
+  while (freeBytes_ > maxFreeBytes)
+  {
+    freeBytes_ -= free_.front().byteCount();
+    destroy(free_.front());
+    free_.pop_front();
+  }
+}
+
+void AtlasPagePool::destroy(AtlasPage const& page)
+{
+  Ogre::MaterialManager::getSingleton().remove(page.material->getName());
+  Ogre::TextureManager::getSingleton().remove(page.texture->getName());
+}
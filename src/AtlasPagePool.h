@@ -0,0 +1,108 @@
+/* Copyright 2018-2019 TomTom N.V.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License. */
+
+#pragma once
+
+#include <cstddef>
+#include <deque>
+
+#include <OGRE/OgreMaterial.h>
+#include <OGRE/OgreTexture.h>
+
+/**
+ * A texture of a TileAtlas together with the material which draws it
+ */
+struct AtlasPage
+{
+  Ogre::TexturePtr texture;
+  Ogre::MaterialPtr material;
+
+  /// host memory equivalent of the texture including its mipmaps
+  std::size_t byteCount() const;
+};
+
+/**
+ * Statistics of an AtlasPagePool
+ */
+struct AtlasPagePoolStats
+{
+  /// number of pages checked out
+  std::size_t used;
+  /// max. number of pages that were checked out at the same time
+  std::size_t usedHighWatermark;
+  /// number of pages that were returned and wait for reuse
+  std::size_t free;
+  /// texture memory of all pages, used or free, in bytes
+  std::size_t bytes;
+  /// number of pages that had to be created
+  std::size_t created;
+  /// number of pages that were reused
+  std::size_t reused;
+};
+
+/**
+ * An AtlasPagePool keeps the pages of destroyed atlases, so that re-creating the atlases (e.g. after the zoom level or
+ * the number of blocks changed) takes the existing textures and materials instead of creating new resources.
+ *
+ * A returned page can be reused for a new page with the same size and mipmap setting only. Therefore, TileAtlas rounds
+ * the sizes of its pages up to powers of two. The free pages are limited by maxFreeBytes, the least recently returned
+ * pages are destroyed first.
+ *
+ * @note Since the pages are Ogre resources, the pool has to be destroyed before Ogre is shut down.
+ */
+class AtlasPagePool
+{
+public:
+  /// Max. texture memory of the free pages in bytes
+  static constexpr std::size_t maxFreeBytes = 256 * 1024 * 1024;
+
+  AtlasPagePool() = default;
+  ~AtlasPagePool();
+
+  AtlasPagePool(AtlasPagePool const&) = delete;
+  AtlasPagePool& operator=(AtlasPagePool const&) = delete;
+
+  /**
+   * Check out a page with a texture of @p width x @p height pixels and @p mipmapLevels mipmap levels besides the full
+   * resolution.
+   *
+   * The texture's content is undefined. The material's blending and depth settings have to be set by the caller, they
+   * may have been changed by the previous user of the page.
+   */
+  AtlasPage acquire(int width, int height, int mipmapLevels);
+
+  /**
+   * Return a page that was checked out by acquire()
+   */
+  void release(AtlasPage page);
+
+  AtlasPagePoolStats stats() const;
+
+private:
+  /**
+   * Destroy the least recently returned free pages until the free pages fit into maxFreeBytes
+   */
+  void trim();
+
+  static void destroy(AtlasPage const& page);
+
+  /// least recently returned first
+  std::deque<AtlasPage> free_;
+  std::size_t freeBytes_{ 0 };
+  std::size_t usedBytes_{ 0 };
+  std::size_t used_{ 0 };
+  std::size_t usedHighWatermark_{ 0 };
+  std::size_t created_{ 0 };
+  std::size_t reused_{ 0 };
+};
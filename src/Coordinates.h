@@ -74,6 +74,42 @@ TileCoordinateGeneric<NumericType> fromWGSCoordinate(WGSCoordinate coord, int zo
   return ret;
 }
 
+/**
+ * Convert a tile coordinate to lat/ lon, i.e. the inverse of fromWGSCoordinate()
+ */
+inline WGSCoordinate toWGSCoordinate(TileCoordinateGeneric<double> coord, int zoom)
+{
+  double const n = 1 << zoom;
+  double const lat_rad = std::atan(std::sinh(M_PI * (1 - 2 * coord.y / n)));
+  return { lat_rad * 180 / M_PI, coord.x / n * 360 - 180 };
+}
+
+/**
+ * The range of latitudes and longitudes covered by a tile, see tileBounds()
+ */
+struct WGSBounds
+{
+  double minLat, maxLat, minLon, maxLon;
+
+  /**
+   * Is @p coord inside of the tile? Like fromWGSCoordinate(), the western and the northern border belong to the tile.
+   */
+  bool contains(WGSCoordinate coord) const
+  {
+    return coord.lat > minLat && coord.lat <= maxLat && coord.lon >= minLon && coord.lon < maxLon;
+  }
+};
+
+/**
+ * The range of latitudes and longitudes covered by the tile at @p coord
+ */
+inline WGSBounds tileBounds(TileCoordinateGeneric<int> coord, int zoom)
+{
+  WGSCoordinate const north_west = toWGSCoordinate({ coord.x + 0.0, coord.y + 0.0 }, zoom);
+  WGSCoordinate const south_east = toWGSCoordinate({ coord.x + 1.0, coord.y + 1.0 }, zoom);
+  return { south_east.lat, north_west.lat, north_west.lon, south_east.lon };
+}
+
 template <typename NumericType>
 bool operator==(TileCoordinateGeneric<NumericType> self, TileCoordinateGeneric<NumericType> other)
 {
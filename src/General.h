@@ -14,6 +14,7 @@ limitations under the License. */
 
 #pragma once
 
+#include <algorithm>
 #include <cmath>
 
 /// Max number of adjacent blocks to support.
@@ -22,18 +23,66 @@ static constexpr int maxBlocks = 8;
 /// Max zoom level to support.
 static constexpr int maxZoom = 22;
 
+/// Max number of coarser zoom levels that are shown around the configured zoom level.
+static constexpr int maxLodLevels = 4;
+
+/// Width/ height of a tile in pixels, unless the tile server serves bigger tiles.
+static constexpr int tileSizePx = 256;
+
+/// Max. width/ height of the tiles of a tile server in pixels.
+static constexpr int maxTileSizePx = 1024;
+
 /**
  * Convert latitude and zoom level to ground resolution.
  * Resolution is how many meters per pixel are covered by a tile.
  *
+ * A tile covers the same area at a zoom level regardless of its size in pixels, so a tile with @p tileSize pixels has
+ * a finer resolution than one with tileSizePx pixels.
+ *
  * @see https://wiki.openstreetmap.org/wiki/Slippy_map_tilenames#Resolution_and_Scale
  */
-inline float zoomToResolution(double lat, int zoom)
+inline float zoomToResolution(double lat, int zoom, int tileSize = tileSizePx)
 {
   float constexpr metersPerPixelZoom0 = 156543.034;
 
   float const latRad = lat * M_PI / 180;
-  return metersPerPixelZoom0 * std::cos(latRad) / (1 << zoom);
+  return metersPerPixelZoom0 * std::cos(latRad) / (1 << zoom) * tileSizePx / tileSize;
+}
+
+/**
+ * The number of zoom levels by which a tile with @p tileSize pixels is finer than one with tileSizePx pixels, i.e.
+ * log2(@p tileSize / tileSizePx)
+ *
+ * For example, the tiles of zoom level 15 with 512 pixels have the resolution of the tiles of zoom level 16 with 256
+ * pixels, but there are only a quarter as many.
+ */
+inline int tileZoomOffset(int tileSize)
+{
+  int offset = 0;
+  while ((tileSizePx << offset) < tileSize)
+  {
+    ++offset;
+  }
+  return offset;
+}
+
+/**
+ * The number of blocks of tiles with @p tileSize pixels that cover about as much of the map as @p blocks blocks of
+ * tiles with tileSizePx pixels, see tileZoomOffset()
+ *
+ * The width of 2 * @p blocks + 1 tiles is divided by the scale of the bigger tiles and rounded to the nearest odd
+ * number of tiles, so that the covered ground and the texture memory stay about the same. A positive number of blocks
+ * stays positive, so that the map always reaches beyond the center tile.
+ */
+inline int scaleBlocks(int blocks, int tileSize)
+{
+  if (blocks <= 0)
+  {
+    return 0;
+  }
+
+  double const scale = 1 << tileZoomOffset(tileSize);
+  return std::max(1, static_cast<int>(std::lround(((2 * blocks + 1) / scale - 1) / 2)));
 }
 
 /**
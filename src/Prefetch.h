@@ -0,0 +1,147 @@
+/* Copyright 2018-2019 TomTom N.V.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License. */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <boost/optional.hpp>
+
+#include "Area.h"
+#include "Coordinates.h"
+#include "General.h"
+#include "TileId.h"
+
+/**
+ * Estimates the velocity of the robot from successive WGS coordinates.
+ *
+ * The velocity is given in degrees per second and smoothed exponentially.
+ */
+class VelocityEstimator
+{
+  boost::optional<std::pair<WGSCoordinate, double>> last_;
+  boost::optional<WGSCoordinate> velocity_;
+
+public:
+  /// Min. time in s between two samples. The position difference of shorter intervals is mostly noise.
+  static constexpr double minInterval = 0.2;
+  /// Max. time in s between two samples. Longer intervals reset the estimate.
+  static constexpr double maxInterval = 5.0;
+  /// Weight of a new sample
+  static constexpr double smoothing = 0.3;
+
+  /**
+   * Add the position @p coord at the time @p stamp (in s)
+   */
+  void update(WGSCoordinate coord, double stamp)
+  {
+    if (!last_)
+    {
+      last_ = std::make_pair(coord, stamp);
+      return;
+    }
+
+    double const dt = stamp - last_->second;
+    if (dt < 0 || dt > maxInterval)
+    {
+      reset();
+      last_ = std::make_pair(coord, stamp);
+      return;
+    }
+    else if (dt < minInterval)
+    {
+      return;
+    }
+
+    WGSCoordinate const sample{ (coord.lat - last_->first.lat) / dt, (coord.lon - last_->first.lon) / dt };
+    if (velocity_)
+    {
+      velocity_->lat = smoothing * sample.lat + (1 - smoothing) * velocity_->lat;
+      velocity_->lon = smoothing * sample.lon + (1 - smoothing) * velocity_->lon;
+    }
+    else
+    {
+      velocity_ = sample;
+    }
+    last_ = std::make_pair(coord, stamp);
+  }
+
+  void reset()
+  {
+    last_ = boost::none;
+    velocity_ = boost::none;
+  }
+
+  /**
+   * The estimated velocity in degrees per second, if enough samples were added
+   */
+  boost::optional<WGSCoordinate> const& velocity() const
+  {
+    return velocity_;
+  }
+};
+
+/**
+ * Tiles that the robot will need within the next @p seconds, if it keeps its @p velocity
+ *
+ * The path from @p position is sampled at every tile it enters. The tiles of the area around each sample are
+ * returned, in the order the robot reaches them, except those which are already in the area around @p center.
+ *
+ * @param center the current center tile
+ * @param blocks the radius of the area around the center tile
+ * @param position the current position
+ * @param velocity the velocity in degrees per second, see VelocityEstimator
+ * @param seconds how far to look ahead
+ */
+inline std::vector<TileId> predictTiles(TileId const& center, int blocks, WGSCoordinate position,
+                                        WGSCoordinate velocity, double seconds)
+{
+  int const zoom = center.zoom;
+  Area const visible(center, blocks);
+
+  // stay inside the valid range of the Mercator projection, see fromWGSCoordinate()
+  WGSCoordinate const end{ std::max(-85.0, std::min(85.0, position.lat + velocity.lat * seconds)),
+                           std::max(-180.0, std::min(180.0, position.lon + velocity.lon * seconds)) };
+
+  auto const from = fromWGSCoordinate<double>(position, zoom);
+  auto const to = fromWGSCoordinate<double>(end, zoom);
+  double const distance = std::max(std::abs(to.x - from.x), std::abs(to.y - from.y));
+
+  // don't look further ahead than the size of the area
+  int const steps = std::min(2 * blocks + 1, static_cast<int>(std::ceil(distance)));
+
+  std::vector<TileId> tiles;
+  std::unordered_set<TileId> seen;
+  for (int step = 1; step <= steps; ++step)
+  {
+    double const t = static_cast<double>(step) / steps;
+    WGSCoordinate const sample{ position.lat + (end.lat - position.lat) * t,
+                                position.lon + (end.lon - position.lon) * t };
+
+    TileId const predicted{ center.tileServer, fromWGSCoordinate(sample, zoom), zoom };
+    for (TileId const& tile : areaTilesCenterOut({ predicted, blocks }))
+    {
+      if (!areaContainsTile(visible, tile) && seen.insert(tile).second)
+      {
+        tiles.push_back(tile);
+      }
+    }
+  }
+
+  return tiles;
+}
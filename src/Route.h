@@ -0,0 +1,58 @@
+/* Copyright 2018-2019 TomTom N.V.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License. */
+
+#pragma once
+
+#include <cmath>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <rosbag/bag.h>
+#include <rosbag/view.h>
+#include <sensor_msgs/NavSatFix.h>
+
+#include "Coordinates.h"
+
+/**
+ * The positions of all valid NavSatFix messages in the bag file at @p path, e.g. for loading the tiles along the route
+ * of a recording, see seed_tiles
+ *
+ * @param topic the topic of the messages, or empty for all NavSatFix topics
+ */
+inline std::vector<WGSCoordinate> readRoute(std::string const& path, std::string const& topic)
+{
+  rosbag::Bag bag(path, rosbag::bagmode::Read);
+  std::unique_ptr<rosbag::View> view;
+  if (topic.empty())
+  {
+    view.reset(new rosbag::View(bag, rosbag::TypeQuery(ros::message_traits::datatype<sensor_msgs::NavSatFix>())));
+  }
+  else
+  {
+    view.reset(new rosbag::View(bag, rosbag::TopicQuery(topic)));
+  }
+
+  std::vector<WGSCoordinate> route;
+  for (rosbag::MessageInstance const& message : *view)
+  {
+    sensor_msgs::NavSatFixConstPtr const fix = message.instantiate<sensor_msgs::NavSatFix>();
+    if (fix && fix->status.status != sensor_msgs::NavSatStatus::STATUS_NO_FIX && std::isfinite(fix->latitude) &&
+        std::isfinite(fix->longitude))
+    {
+      route.push_back({ fix->latitude, fix->longitude });
+    }
+  }
+  return route;
+}
@@ -0,0 +1,142 @@
+/* Copyright 2018-2019 TomTom N.V.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License. */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <QImage>
+
+#include "Area.h"
+#include "TileId.h"
+
+/**
+ * How a DEM tile encodes the elevation in meter in the RGB channels of its pixels
+ */
+enum class TerrainEncoding
+{
+  /// elevation = R * 256 + G + B / 256 - 32768, e.g. the Terrarium tiles of the AWS Terrain Tiles
+  Terrarium,
+  /// elevation = -10000 + (R * 65536 + G * 256 + B) * 0.1, e.g. the Mapbox Terrain-RGB tiles
+  MapboxTerrainRgb
+};
+
+/// DEM tiles are loaded up to this zoom level, the tiles of finer zoom levels use a part of their DEM tile
+int constexpr maxTerrainZoom = 15;
+
+/// number of grid segments along each border of a tile that is draped on the terrain, see TileMesh
+int constexpr terrainSegments = 8;
+
+/**
+ * The elevation in meter encoded in the pixel @p pixel
+ */
+inline float decodeElevation(QRgb pixel, TerrainEncoding encoding)
+{
+  int const r = qRed(pixel);
+  int const g = qGreen(pixel);
+  int const b = qBlue(pixel);
+  switch (encoding)
+  {
+    case TerrainEncoding::MapboxTerrainRgb:
+      return -10000.0f + (r * 65536 + g * 256 + b) * 0.1f;
+    case TerrainEncoding::Terrarium:
+    default:
+      return r * 256.0f + g + b / 256.0f - 32768.0f;
+  }
+}
+
+/**
+ * The elevation in meter at the point (@p u, @p v) of the decoded DEM tile @p dem (see detail::decodeTileImage()),
+ * with (0, 0) being the north-western and (1, 1) the south-eastern corner of the tile
+ *
+ * The elevation is interpolated bilinearly between the centers of the pixels around the point. The pixels are decoded
+ * before they are interpolated, since their channels don't encode the elevation linearly.
+ */
+inline float sampleElevation(QImage const& dem, TerrainEncoding encoding, float u, float v)
+{
+  int const width = dem.width();
+  int const height = dem.height();
+  float const px = std::min(std::max(u * width - 0.5f, 0.0f), width - 1.0f);
+  float const py = std::min(std::max(v * height - 0.5f, 0.0f), height - 1.0f);
+  int const x0 = static_cast<int>(px);
+  int const y0 = static_cast<int>(py);
+  int const x1 = std::min(x0 + 1, width - 1);
+  int const y1 = std::min(y0 + 1, height - 1);
+  float const fx = px - x0;
+  float const fy = py - y0;
+
+  auto const* top = reinterpret_cast<QRgb const*>(dem.constScanLine(y0));
+  auto const* bottom = reinterpret_cast<QRgb const*>(dem.constScanLine(y1));
+  float const north = (1 - fx) * decodeElevation(top[x0], encoding) + fx * decodeElevation(top[x1], encoding);
+  float const south = (1 - fx) * decodeElevation(bottom[x0], encoding) + fx * decodeElevation(bottom[x1], encoding);
+  return (1 - fy) * north + fy * south;
+}
+
+/**
+ * The DEM tile on the tile server @p terrainServer that covers the tile @p tileId, i.e. the tile itself or its
+ * ancestor at maxTerrainZoom
+ */
+inline TileId terrainTileOf(TileId const& tileId, TileServer const& terrainServer)
+{
+  TileId const tile = ancestorOf(tileId, std::max(0, tileId.zoom - maxTerrainZoom));
+  return { terrainServer, tile.coord, tile.zoom };
+}
+
+/**
+ * The area of DEM tiles on the tile server @p terrainServer that covers the @p area, see terrainTileOf()
+ */
+inline Area terrainAreaOf(Area area, TileServer const& terrainServer)
+{
+  int const levels = std::max(0, area.center.zoom - maxTerrainZoom);
+  area.leftTop = { area.leftTop.x >> levels, area.leftTop.y >> levels };
+  area.rightBottom = { area.rightBottom.x >> levels, area.rightBottom.y >> levels };
+  area.center = terrainTileOf(area.center, terrainServer);
+  return area;
+}
+
+/**
+ * Sample the height field of the tile @p tileId from its decoded DEM tile @p dem, which is the tile @p demTile (see
+ * terrainTileOf())
+ *
+ * The height field has `segments + 1` x `segments + 1` vertices, in the order expected by TileMesh::setQuad(): row by
+ * row from the southern to the northern border of the tile, and each row from west to east. Neighbouring tiles sample
+ * the same elevation on their common border, so that the terrain has no cracks inside a DEM tile.
+ *
+ * @param reference the elevation that is subtracted from all heights, i.e. the elevation at the height 0
+ */
+inline std::vector<float> terrainHeights(QImage const& dem, TileId const& demTile, TileId const& tileId, int segments,
+                                         TerrainEncoding encoding, float reference)
+{
+  int const levels = tileId.zoom - demTile.zoom;
+  float const scale = 1 << levels;
+  // position of tileId inside the DEM tile, in tiles
+  int const offset_x = tileId.coord.x - (demTile.coord.x << levels);
+  int const offset_y = tileId.coord.y - (demTile.coord.y << levels);
+
+  std::vector<float> heights;
+  heights.reserve((segments + 1) * (segments + 1));
+  for (int row = 0; row <= segments; ++row)
+  {
+    // v = 0 is the northern border of the DEM tile
+    float const v = (offset_y + 1 - static_cast<float>(row) / segments) / scale;
+    for (int column = 0; column <= segments; ++column)
+    {
+      float const u = (offset_x + static_cast<float>(column) / segments) / scale;
+      heights.push_back(sampleElevation(dem, encoding, u, v) - reference);
+    }
+  }
+  return heights;
+}
@@ -0,0 +1,167 @@
+/* Copyright 2018-2019 TomTom N.V.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License. */
+
+#include "TileAtlas.h"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+#include <OGRE/OgreHardwarePixelBuffer.h>
+
+namespace
+{
+/**
+ * The smallest power of two which is at least @p size
+ */
+int nextPowerOfTwo(int size)
+{
+  int power = 1;
+  while (power < size)
+  {
+    power *= 2;
+  }
+  return power;
+}
+}  // namespace
+
+TileAtlas::TileAtlas(AtlasPagePool& pool, int tileSize, std::size_t cellCount, bool mipmaps)
+  : pool_(pool)
+  , tileSize_(tileSize)
+  , gutter_(mipmaps ? 1 << mipmapLevels : 0)
+  , cellStride_(tileSize + 2 * gutter_)
+  , cellCount_(cellCount)
+  , staging_(mipmaps ? mipmapLevels + 1 : 0)
+{
+  // use all cells that fit into a page whose width is a power of two, so that the pool can reuse pages of atlases
+  // with a slightly different number of cells
+  int const maxSize = maxPageSize;
+  int const cellsNeeded = static_cast<int>(std::ceil(std::sqrt(static_cast<double>(cellCount))));
+  int const pageWidth = std::min(maxSize, nextPowerOfTwo(cellsNeeded * cellStride_));
+  cellsPerRow_ = std::max(1, pageWidth / cellStride_);
+  cellsPerPage_ = static_cast<std::size_t>(cellsPerRow_) * cellsPerRow_;
+
+  for (std::size_t first = 0; first < cellCount_; first += cellsPerPage_)
+  {
+    std::size_t const cellsInPage = std::min(cellsPerPage_, cellCount_ - first);
+    int const rows = static_cast<int>((cellsInPage + cellsPerRow_ - 1) / cellsPerRow_);
+    int const pageHeight = std::min(maxSize, nextPowerOfTwo(rows * cellStride_));
+    pages_.push_back(pool_.acquire(pageWidth, pageHeight, mipmaps ? mipmapLevels : 0));
+  }
+}
+
+TileAtlas::~TileAtlas()
+{
+  for (AtlasPage& page : pages_)
+  {
+    pool_.release(std::move(page));
+  }
+}
+
+AtlasRect TileAtlas::cellRect(std::size_t cell) const
+{
+  AtlasPage const& page = pages_[pageOf(cell)];
+  std::size_t const index = indexInPage(cell);
+  int const column = static_cast<int>(index % cellsPerRow_);
+  int const row = static_cast<int>(index / cellsPerRow_);
+
+  float const width = page.texture->getWidth();
+  float const height = page.texture->getHeight();
+  float const left = column * cellStride_ + gutter_;
+  float const top = row * cellStride_ + gutter_;
+
+  // inset by half a texel, so that bilinear filtering doesn't bleed into neighboring cells
+  return { (left + 0.5f) / width, (top + 0.5f) / height, (left + tileSize_ - 0.5f) / width,
+           (top + tileSize_ - 0.5f) / height };
+}
+
+void TileAtlas::upload(std::size_t cell, QImage const& image)
+{
+  std::size_t const index = indexInPage(cell);
+  std::size_t const left = (index % cellsPerRow_) * cellStride_;
+  std::size_t const top = (index / cellsPerRow_) * cellStride_;
+  Ogre::TexturePtr const& texture = pages_[pageOf(cell)].texture;
+
+  if (staging_.empty())
+  {
+    Ogre::Box const cellBox(left, top, left + tileSize_, top + tileSize_);
+
+    // Ogre expects the row pitch in pixels
+    Ogre::PixelBox source(image.width(), image.height(), 1, Ogre::PF_X8R8G8B8, const_cast<uchar*>(image.constBits()));
+    source.rowPitch = image.bytesPerLine() / 4;
+    texture->getBuffer()->blitFromMemory(source, cellBox);
+    return;
+  }
+
+  fillStaging(image);
+  for (std::size_t level = 0; level < staging_.size(); ++level)
+  {
+    // the cell stride is a multiple of 2^mipmapLevels, so the cells are aligned on every level
+    std::size_t const size = cellStride_ >> level;
+    Ogre::Box const cellBox(left >> level, top >> level, (left >> level) + size, (top >> level) + size);
+    Ogre::PixelBox const source(size, size, 1, Ogre::PF_X8R8G8B8, staging_[level].data());
+    texture->getBuffer(0, level)->blitFromMemory(source, cellBox);
+  }
+}
+
+void TileAtlas::fillStaging(QImage const& image)
+{
+  QImage const scaled = image.width() == tileSize_ && image.height() == tileSize_ ?
+                            image :
+                            image.scaled(tileSize_, tileSize_, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+
+  std::vector<Ogre::uint32>& pixels = staging_[0];
+  pixels.resize(static_cast<std::size_t>(cellStride_) * cellStride_);
+  for (int y = 0; y < cellStride_; ++y)
+  {
+    int const source_y = std::min(std::max(y - gutter_, 0), tileSize_ - 1);
+    auto const* source = reinterpret_cast<Ogre::uint32 const*>(scaled.constScanLine(source_y));
+    Ogre::uint32* row = pixels.data() + static_cast<std::size_t>(y) * cellStride_;
+
+    std::fill(row, row + gutter_, source[0]);
+    std::copy(source, source + tileSize_, row + gutter_);
+    std::fill(row + gutter_ + tileSize_, row + cellStride_, source[tileSize_ - 1]);
+  }
+
+  // average 2x2 pixels per channel
+  for (std::size_t level = 1; level < staging_.size(); ++level)
+  {
+    int const size = cellStride_ >> level;
+    std::vector<Ogre::uint32> const& finer = staging_[level - 1];
+    std::vector<Ogre::uint32>& coarser = staging_[level];
+    coarser.resize(static_cast<std::size_t>(size) * size);
+
+    for (int y = 0; y < size; ++y)
+    {
+      for (int x = 0; x < size; ++x)
+      {
+        Ogre::uint32 const* top = finer.data() + static_cast<std::size_t>(2 * y) * (2 * size) + 2 * x;
+        Ogre::uint32 const* bottom = top + 2 * size;
+        Ogre::uint32 const quad[4] = { top[0], top[1], bottom[0], bottom[1] };
+
+        Ogre::uint32 average = 0xff000000;
+        for (int shift = 0; shift < 24; shift += 8)
+        {
+          Ogre::uint32 sum = 0;
+          for (Ogre::uint32 const pixel : quad)
+          {
+            sum += (pixel >> shift) & 0xff;
+          }
+          average |= ((sum + 2) / 4) << shift;
+        }
+        coarser[static_cast<std::size_t>(y) * size + x] = average;
+      }
+    }
+  }
+}
@@ -0,0 +1,142 @@
+/* Copyright 2018-2019 TomTom N.V.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License. */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#include <QImage>
+#include <OGRE/OgreMaterial.h>
+#include <OGRE/OgreTexture.h>
+
+#include "AtlasPagePool.h"
+
+/**
+ * Texture coordinates of a cell inside its atlas page
+ */
+struct AtlasRect
+{
+  float u0, v0, u1, v1;
+};
+
+/**
+ * A TileAtlas packs the textures of equally sized tiles into a few large textures, called pages.
+ *
+ * Every tile is uploaded into a cell of a page. Since all cells of a page share the page's material, a whole grid of
+ * tiles can be drawn with one draw call per page instead of one draw call per tile.
+ *
+ * The textures have 32bit pixels, so that the rows of all images are aligned and can be uploaded without conversion.
+ *
+ * With mipmaps, every cell is surrounded by a gutter of replicated border pixels, so that the coarser mipmap levels
+ * don't blend neighboring cells. The mipmaps are generated per cell on upload, since regenerating the mipmaps of a
+ * whole page on the GPU would filter all of its cells again for every uploaded tile.
+ */
+class TileAtlas
+{
+public:
+  /// Max. width/ height of a page in pixels
+  static constexpr int maxPageSize = 4096;
+  /// Number of mipmap levels besides the full resolution, if mipmaps are enabled
+  static constexpr int mipmapLevels = 3;
+
+  /**
+   * @param pool provides the pages, which are returned to it when the atlas is destroyed
+   * @param tileSize width/ height of a cell in pixels, which has to be a multiple of 2^mipmapLevels if @p mipmaps is
+   * set
+   * @param cellCount the number of cells to allocate
+   * @param mipmaps whether to use mipmaps
+   */
+  TileAtlas(AtlasPagePool& pool, int tileSize, std::size_t cellCount, bool mipmaps = false);
+  ~TileAtlas();
+
+  TileAtlas(TileAtlas const&) = delete;
+  TileAtlas& operator=(TileAtlas const&) = delete;
+
+  std::size_t cellCount() const
+  {
+    return cellCount_;
+  }
+
+  std::size_t pageCount() const
+  {
+    return pages_.size();
+  }
+
+  /**
+   * Index of the page which contains the cell @p cell
+   */
+  std::size_t pageOf(std::size_t cell) const
+  {
+    return cell / cellsPerPage_;
+  }
+
+  /**
+   * Index of the cell @p cell inside its page
+   */
+  std::size_t indexInPage(std::size_t cell) const
+  {
+    return cell % cellsPerPage_;
+  }
+
+  /**
+   * Number of cells in the page @p page
+   */
+  std::size_t cellsInPage(std::size_t page) const
+  {
+    return std::min(cellsPerPage_, cellCount_ - page * cellsPerPage_);
+  }
+
+  /**
+   * Material to draw the cells of the page @p page with
+   */
+  Ogre::MaterialPtr const& material(std::size_t page) const
+  {
+    return pages_[page].material;
+  }
+
+  /**
+   * Texture coordinates of the cell @p cell in its page
+   */
+  AtlasRect cellRect(std::size_t cell) const;
+
+  /**
+   * Upload a 32bit RGB image (QImage::Format_RGB32, or QImage::Format_ARGB32 whose alpha is ignored) into the cell
+   * @p cell. The image is scaled if it doesn't match the cell size.
+   *
+   * The image is uploaded as is, i.e. v = 0 of the cell is the first row of the image.
+   */
+  void upload(std::size_t cell, QImage const& image);
+
+private:
+  /**
+   * Copy the @p image into `staging_[0]` and replicate its border pixels into the gutter, then downsample it into the
+   * other staging buffers
+   */
+  void fillStaging(QImage const& image);
+
+  AtlasPagePool& pool_;
+  int tileSize_;
+  /// width of the gutter around each cell in pixels, 0 without mipmaps
+  int gutter_;
+  /// distance between the cells in pixels
+  int cellStride_;
+  std::size_t cellCount_;
+  int cellsPerRow_;
+  std::size_t cellsPerPage_;
+  std::vector<AtlasPage> pages_;
+  /// per mipmap level, the pixels of a cell including its gutter; reused by every upload
+  std::vector<std::vector<Ogre::uint32>> staging_;
+};
@@ -15,10 +15,15 @@ limitations under the License. */
 #pragma once
 
 #include <utility>
+#include <memory>
 #include <unordered_map>
+#include <unordered_set>
+#include <list>
 #include <mutex>
 #include <limits>
 #include <functional>
+#include <algorithm>
+#include <vector>
 
 #include <QImage>
 
@@ -29,23 +34,18 @@ limitations under the License. */
 #include "detail/TileDownloader.h"
 
 /**
- * Helper that you have to use when accessing tiles of a TileCache
+ * Statistics of a TileCache
  */
-class TileCacheGuard
+struct TileCacheStats
 {
-  std::mutex& mutex;
-
-public:
-  template <typename TileCache>
-  TileCacheGuard(TileCache const& cache_) : mutex(cache_.cachedTilesLock)
-  {
-    mutex.lock();
-  }
-
-  ~TileCacheGuard()
-  {
-    mutex.unlock();
-  }
+  /// number of cached tiles
+  std::size_t tiles;
+  /// memory used by the cached tiles in bytes
+  std::size_t bytes;
+  /// number of requested tiles that were already cached
+  std::size_t hits;
+  /// number of requested tiles that had to be loaded
+  std::size_t misses;
 };
 
 /**
@@ -56,60 +56,170 @@ public:
  * This class provides an interface to request tiles and then access them later on (when they are drawn).
  *
  * Tiles will be either loaded from the file system (after they have been cached) or from a tile server.
+ * All tile caches of the process share one detail::TileDownloader, so that several layers share the connections, the
+ * disk cache and the scheduling of the requests.
+ *
+ * Tiles are kept after they left the requested area, until the cache exceeds its size limit. Then the least recently
+ * used tiles are removed first. Tile has to provide the method `std::size_t byteCount() const`.
+ *
+ * Tiles are handed out as shared handles, which keep a tile alive even if it's removed from the cache meanwhile. The
+ * internal lock is only held while looking up or changing the index of the tiles, so a reader that works with the
+ * tiles (e.g. uploads them to the GPU) never blocks the loading of other tiles and vice versa.
  */
 template <typename Tile>
 class TileCache
 {
-  friend TileCacheGuard;
-  std::unordered_map<TileId, Tile> cachedTiles;
+protected:
+  /// guards the cached tiles, the statistics and anything of a derived class that the callbacks below access
   std::mutex mutable cachedTilesLock;
-  detail::TileDownloader downloader;
+  /// Called with `cachedTilesLock` locked after a tile was added to the cache
+  std::function<void(TileId const&)> onTileAdded;
+  /// Called with `cachedTilesLock` locked after a tile was removed from the cache
+  std::function<void(TileId const&)> onTileRemoved;
+
+private:
+  struct Entry
+  {
+    std::shared_ptr<Tile const> tile;
+    /// position in `lru`
+    std::list<TileId>::iterator lruPosition;
+  };
+  std::unordered_map<TileId, Entry> cachedTiles;
+  /// the ids of all cached tiles, most recently used first
+  std::list<TileId> lru;
+  std::size_t cachedBytes{ 0 };
+  std::size_t maxBytes{ std::numeric_limits<std::size_t>::max() };
+  std::size_t hits{ 0 };
+  std::size_t misses{ 0 };
+  /// shared with the other tile caches, see detail::TileDownloader::shared()
+  std::shared_ptr<detail::TileDownloader> downloader;
+  detail::TileDownloader::ClientId client;
 
   /**
    * Callback for `downloader`
    */
   void loadedTile(TileId tileId, QImage image)
   {
-    TileCacheGuard guard(*this);
+    // allocate outside of the lock
+    auto tile = std::make_shared<Tile const>(std::move(image));
+    std::size_t const bytes = tile->byteCount();
 
+    std::lock_guard<std::mutex> guard(cachedTilesLock);
     if (cachedTiles.find(tileId) == cachedTiles.end())
     {
-      cachedTiles.emplace(std::make_pair(tileId, std::move(image)));
+      lru.push_front(tileId);
+      cachedTiles.emplace(tileId, Entry{ std::move(tile), lru.begin() });
+      cachedBytes += bytes;
+      if (onTileAdded)
+      {
+        onTileAdded(tileId);
+      }
+    }
+  }
+
+  /**
+   * Mark a cached tile as most recently used
+   * @note `cachedTilesLock` has to be locked.
+   */
+  void touch(TileId const& tileId)
+  {
+    auto const it = cachedTiles.find(tileId);
+    if (it != cachedTiles.end())
+    {
+      lru.splice(lru.begin(), lru, it->second.lruPosition);
     }
   }
 
 public:
-  TileCache() : downloader([this](TileId tileId, QImage image) { loadedTile(std::move(tileId), std::move(image)); }){};
+  TileCache()
+    : downloader(detail::TileDownloader::shared())
+    , client(downloader->addClient(
+          [this](TileId tileId, QImage image) { loadedTile(std::move(tileId), std::move(image)); }))
+  {
+  }
+
+  ~TileCache()
+  {
+    downloader->removeClient(client);
+  }
+
+  TileCache(TileCache const&) = delete;
+  TileCache& operator=(TileCache const&) = delete;
 
   /**
-   * Load a rectangular area of tiles
+   * Load rectangular areas of tiles
+   *
+   * The requested tiles will be loaded into this cache from either the file system or an online tile server. The
+   * @p areas are loaded in their order, and tiles near the center of an area are loaded first. Afterwards the tiles in
+   * @p prefetch are loaded in their order. Pending loads of all other tiles are cancelled.
    *
-   * The requested tiles will be loaded into this cache from either the file system or an online tile server.
+   * If @p fallbackLevels is positive, the tiles @p fallbackLevels zoom levels above that cover the @p areas are loaded
+   * before all other tiles. They are few, so they can be shown quickly until the @p areas are loaded, see
+   * nearestAncestor().
    */
-  void request(Area const& area)
+  void request(std::vector<Area> const& areas, std::vector<TileId> const& prefetch = {}, int fallbackLevels = 0)
   {
-    TileCacheGuard guard(*this);
+    std::vector<TileId> wanted;
+    for (Area const& area : areas)
+    {
+      int const levels = std::min(fallbackLevels, area.center.zoom);
+      if (levels > 0)
+      {
+        for (int x = area.leftTop.x >> levels; x <= area.rightBottom.x >> levels; ++x)
+        {
+          for (int y = area.leftTop.y >> levels; y <= area.rightBottom.y >> levels; ++y)
+          {
+            wanted.push_back({ area.center.tileServer, { x, y }, area.center.zoom - levels });
+          }
+        }
+      }
+    }
+
+    for (Area const& area : areas)
+    {
+      std::vector<TileId> const tiles = areaTilesCenterOut(area);
+      wanted.insert(wanted.end(), tiles.begin(), tiles.end());
+    }
+    wanted.insert(wanted.end(), prefetch.begin(), prefetch.end());
 
-    for (int x = area.leftTop.x; x <= area.rightBottom.x; ++x)
+    // the areas of different zoom levels overlap with each other's fallback tiles
+    std::unordered_set<TileId> seen;
+    std::vector<TileId> missing;
     {
-      for (int y = area.leftTop.y; y <= area.rightBottom.y; ++y)
+      std::lock_guard<std::mutex> guard(cachedTilesLock);
+      for (TileId const& toFind : wanted)
       {
-        TileId const toFind{ area.center.tileServer, { x, y }, area.center.zoom };
+        if (!seen.insert(toFind).second)
+        {
+          continue;
+        }
 
         if (cachedTiles.find(toFind) == cachedTiles.end())
         {
-          downloader.loadTile(toFind);
+          // pending tiles are still wanted, but the downloader doesn't request them again
+          if (!downloader->isPending(toFind))
+          {
+            ++misses;
+          }
+          missing.push_back(toFind);
+        }
+        else
+        {
+          ++hits;
         }
       }
     }
+
+    // the downloader calls loadedTile(), which takes the lock
+    downloader->loadTiles(client, missing);
   }
 
   /**
    * Is the tile @p toFind cached? If yes, return the associated Tile.
-   * @note You have to use TileCacheGuard to guard this function call and the returned tile.
    */
-  Tile const* ready(TileId const& toFind) const
+  std::shared_ptr<Tile const> ready(TileId const& toFind) const
   {
+    std::lock_guard<std::mutex> guard(cachedTilesLock);
     auto const it = cachedTiles.find(toFind);
 
     if (it == cachedTiles.cend())
@@ -117,57 +227,152 @@ public:
       return nullptr;
     }
 
-    return &it->second;
+    return it->second.tile;
+  }
+
+  /**
+   * Find the nearest cached ancestor of @p tileId, i.e. the cached tile with the highest zoom level that covers
+   * @p tileId. At most @p maxLevels zoom levels above @p tileId are searched.
+   * @return the id of the ancestor and the ancestor, or nullptr if no ancestor is cached
+   */
+  std::pair<TileId, std::shared_ptr<Tile const>> nearestAncestor(TileId const& tileId, int maxLevels) const
+  {
+    std::lock_guard<std::mutex> guard(cachedTilesLock);
+    for (int levels = 1; levels <= maxLevels && levels <= tileId.zoom; ++levels)
+    {
+      TileId const ancestor = ancestorOf(tileId, levels);
+      auto const it = cachedTiles.find(ancestor);
+      if (it != cachedTiles.cend())
+      {
+        return { ancestor, it->second.tile };
+      }
+    }
+
+    return { tileId, nullptr };
   }
 
   /**
-   * Remove tiles from cache that are not in the @p area (anymore)
-   * @note You have to use TileCacheGuard to guard this function call.
+   * Mark the tiles in the @p areas as used and remove the least recently used tiles until the cache fits its size
+   * limit. Tiles inside the @p areas are never removed.
    */
-  void purge(Area const& area)
+  void purge(std::vector<Area> const& areas)
   {
-    for (auto it = cachedTiles.begin(); it != cachedTiles.end();)
+    // the removed tiles are destroyed after the lock is released
+    std::vector<std::shared_ptr<Tile const>> removed;
+    std::lock_guard<std::mutex> guard(cachedTilesLock);
+
+    for (Area const& area : areas)
     {
-      if (!areaContainsTile(area, it->first))
+      for (int x = area.leftTop.x; x <= area.rightBottom.x; ++x)
       {
-        it = cachedTiles.erase(it);
+        for (int y = area.leftTop.y; y <= area.rightBottom.y; ++y)
+        {
+          touch({ area.center.tileServer, { x, y }, area.center.zoom });
+        }
       }
-      else
+    }
+
+    auto const inAreas = [&areas](TileId const& tileId) {
+      return std::any_of(areas.begin(), areas.end(),
+                         [&tileId](Area const& area) { return areaContainsTile(area, tileId); });
+    };
+
+    // walk from the least recently used tile to the front, skipping the tiles in the areas
+    auto position = lru.end();
+    while (cachedBytes > maxBytes && position != lru.begin())
+    {
+      --position;
+      if (inAreas(*position))
       {
-        ++it;
+        continue;
       }
+
+      auto const it = cachedTiles.find(*position);
+      cachedBytes -= it->second.tile->byteCount();
+      removed.push_back(std::move(it->second.tile));
+      cachedTiles.erase(it);
+      if (onTileRemoved)
+      {
+        onTileRemoved(*position);
+      }
+      position = lru.erase(position);
     }
   }
 
+  /**
+   * Set the size limit of the cache in bytes. The limit is applied on the next purge().
+   */
+  void setMaxBytes(std::size_t bytes)
+  {
+    std::lock_guard<std::mutex> guard(cachedTilesLock);
+    maxBytes = bytes;
+  }
+
+  TileCacheStats stats() const
+  {
+    std::lock_guard<std::mutex> guard(cachedTilesLock);
+    return { cachedTiles.size(), cachedBytes, hits, misses };
+  }
+
+  /**
+   * @see detail::TileDownloader::setTileServerSettings
+   */
+  void setTileServerSettings(TileServer tileServer, detail::TileServerSettings const& settings)
+  {
+    downloader->setTileServerSettings(tileServer, settings);
+  }
+
+  /**
+   * @see detail::TileDownloader::setDiskCacheLimits
+   * @note The disk cache is shared by all tile caches, the last call sets the limits of all of them.
+   */
+  void setDiskCacheLimits(qint64 maxBytes, qint64 maxAge)
+  {
+    downloader->setDiskCacheLimits(maxBytes, maxAge);
+  }
+
+  /**
+   * @see detail::TileDownloader::diskCacheStats
+   */
+  boost::optional<detail::DiskCacheStats> diskCacheStats() const
+  {
+    return downloader->diskCacheStats();
+  }
+
+  /**
+   * @see detail::TileDownloader::pipelineStats
+   */
+  detail::PipelineStats pipelineStats() const
+  {
+    return downloader->pipelineStats();
+  }
+
   /**
    * @brief Calculate the error rate of a tile server
    *
-   * error rate = number of HTTP requests that resulted in an error / total number of HTTP requests
+   * error rate = number of HTTP requests that resulted in an error / total number of HTTP requests, within the last
+   * detail::ErrorRateManager::window
    */
-  float getTileServerErrorRate(std::string const& tileServer) const
+  float getTileServerErrorRate(TileServer tileServer) const
   {
-    return downloader.errorRates.calculate(tileServer);
+    return downloader->errorRates.calculate(tileServer);
   }
 
-protected:
   /**
-   * Are all tiles in the area cached?
-   * @note You have to use TileCacheGuard to guard this function call.
+   * @see detail::TileDownloader::isThrottled
    */
-  bool isAreaReady(Area const& area) const
+  bool isTileServerThrottled(TileServer tileServer) const
   {
-    for (int xx = area.leftTop.x; xx <= area.rightBottom.x; ++xx)
-    {
-      for (int yy = area.leftTop.y; yy <= area.rightBottom.y; ++yy)
-      {
-        TileId const toFind{ area.center.tileServer, { xx, yy }, area.center.zoom };
+    return downloader->isThrottled(tileServer);
+  }
 
-        if (cachedTiles.find(toFind) == cachedTiles.end())
-        {
-          return false;
-        }
-      }
-    }
-    return true;
+protected:
+  /**
+   * Like ready(), but `cachedTilesLock` has to be locked
+   */
+  std::shared_ptr<Tile const> find(TileId const& toFind) const
+  {
+    auto const it = cachedTiles.find(toFind);
+    return it != cachedTiles.cend() ? it->second.tile : nullptr;
   }
 };
@@ -14,15 +14,16 @@ limitations under the License. */
 
 #pragma once
 
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
 #include <vector>
 
-#include <QTimer>
-
 #include "TileCache.h"
 
-template <typename Tile>
-class TileCacheDelay;
-
 namespace detail
 {
 /**
@@ -32,97 +33,188 @@ namespace detail
  */
 struct ExpiringArea
 {
-  QTimer timer;
+  using Clock = std::chrono::steady_clock;
+
   Area area;
+  /// when the area gets ready, even if not all of its tiles are loaded
+  Clock::time_point deadline;
+  /// number of the area's tiles which are cached
+  std::size_t loaded;
+  /// whether the area is ready to be displayed, i.e. it expired or all of its tiles were loaded
+  bool ready;
 
-  ExpiringArea(Area area) : area(std::move(area))
+  std::size_t tileCount() const
   {
-    timer.setSingleShot(true);
-    int constexpr timeout = 2000;  // in ms
-    timer.start(timeout);
+    return static_cast<std::size_t>(area.rightBottom.x - area.leftTop.x + 1) *
+           static_cast<std::size_t>(area.rightBottom.y - area.leftTop.y + 1);
   }
+};
+
+/**
+ * A record of Areas that were visited by the robot.
+ *
+ * Instead of checking the areas on every lookup, the history counts the loaded tiles of each area when tiles are
+ * added to or removed from the cache, and it counts for each tile the ready areas which contain it. Therefore ready()
+ * is a single hash lookup.
+ */
+class AreaHistory
+{
+public:
+  using Clock = ExpiringArea::Clock;
 
-  ExpiringArea(ExpiringArea&&) = default;
-  ExpiringArea(ExpiringArea const& p) : area(p.area)
+  /**
+   * Remove all Areas that don't contain the center of any of the @p areas
+   */
+  void fit(std::vector<Area> const& areas)
   {
-    *this = p;
+    auto const outdated = [&areas](ExpiringArea const& p) {
+      return std::none_of(areas.begin(), areas.end(),
+                          [&p](Area const& area) { return areaContainsTile(p.area, area.center); });
+    };
+
+    for (ExpiringArea const& p : history_)
+    {
+      if (p.ready && outdated(p))
+      {
+        forEachTile(p.area, [this](TileId const& tileId) {
+          auto const it = readyAreas_.find(tileId);
+          if (--it->second == 0)
+          {
+            readyAreas_.erase(it);
+          }
+        });
+      }
+    }
+    history_.erase(std::remove_if(history_.begin(), history_.end(), outdated), history_.end());
+    updateNextDeadline();
   }
 
   /**
-   * Is this Area ready to be displayed?
+   * Add a new Area to the history.
    *
-   * Ready means that either the whole area is fully loaded or that the area expired.
+   * @param area Area to add to the history.
+   * @param isCached tells whether a tile is cached, to count the tiles of the area which are already loaded
    */
-  template <typename Tile>
-  bool ready(TileCacheDelay<Tile> const& cache) const
+  template <typename IsCached>
+  void add(Area const& area, IsCached const& isCached)
   {
-    if (!timer.isActive())
+    auto const it =
+        std::find_if(history_.begin(), history_.end(), [&area](ExpiringArea const& p) { return p.area == area; });
+    if (it != history_.end())
     {
-      return true;
+      return;
     }
 
-    return cache.isAreaReady(area);
-  }
+    std::size_t loaded = 0;
+    forEachTile(area, [&loaded, &isCached](TileId const& tileId) { loaded += isCached(tileId) ? 1 : 0; });
 
-  ExpiringArea& operator=(ExpiringArea&&) = default;
+    int constexpr timeout = 2000;  // in ms
+    history_.push_back({ area, Clock::now() + std::chrono::milliseconds(timeout), loaded, false });
+    if (loaded == history_.back().tileCount())
+    {
+      markReady(history_.back());
+    }
+    else
+    {
+      nextDeadline_ = std::min(nextDeadline_, history_.back().deadline);
+    }
+  }
 
-  ExpiringArea& operator=(ExpiringArea const& p)
+  /**
+   * Count the tile @p tileId, which was added to the cache, as loaded
+   */
+  void tileAdded(TileId const& tileId)
   {
-    area = p.area;
-
-    // QTimer has no copy operator
-    if (p.timer.isActive())
+    for (ExpiringArea& p : history_)
     {
-      timer.start(p.timer.remainingTime());
+      if (!p.ready && areaContainsTile(p.area, tileId) && ++p.loaded == p.tileCount())
+      {
+        markReady(p);
+      }
     }
-    return *this;
   }
-};
 
-/**
- * A record of Areas that were visited by the robot.
- */
-class AreaHistory
-{
-  /// History of areas that will be or were drawn in Rviz
-  std::vector<ExpiringArea> history_;
-
-public:
   /**
-   * Remove all Areas that aren't in @p area
+   * Don't count the tile @p tileId, which was removed from the cache, as loaded anymore
    */
-  void fit(Area const& area)
+  void tileRemoved(TileId const& tileId)
   {
-    history_.erase(std::remove_if(history_.begin(), history_.end(),
-                                  [&area](ExpiringArea const& p) { return !areaContainsTile(p.area, area.center); }),
-                   history_.end());
+    for (ExpiringArea& p : history_)
+    {
+      // never wrap around, otherwise the area could only get ready by its deadline
+      if (!p.ready && p.loaded > 0 && areaContainsTile(p.area, tileId))
+      {
+        --p.loaded;
+      }
+    }
   }
 
   /**
-   * Add a new Area to the history.
-   *
-   * @param area Area to add to the history.
+   * Is the tile in at least one Area that is ready?
    */
-  void add(Area const& area)
+  bool ready(TileId const& toFind)
   {
-    auto const it =
-        std::find_if(history_.begin(), history_.end(), [&area](ExpiringArea const& p) { return p.area == area; });
-    if (it == history_.end())
+    expire(Clock::now());
+    return readyAreas_.find(toFind) != readyAreas_.end();
+  }
+
+private:
+  template <typename Function>
+  static void forEachTile(Area const& area, Function const& function)
+  {
+    for (int x = area.leftTop.x; x <= area.rightBottom.x; ++x)
     {
-      history_.emplace_back(area);
+      for (int y = area.leftTop.y; y <= area.rightBottom.y; ++y)
+      {
+        function(TileId{ area.center.tileServer, { x, y }, area.center.zoom });
+      }
     }
-  };
+  }
+
+  void markReady(ExpiringArea& p)
+  {
+    p.ready = true;
+    forEachTile(p.area, [this](TileId const& tileId) { ++readyAreas_[tileId]; });
+  }
 
   /**
-   * Is the tile in at least one Area that is ready?
+   * Mark the areas whose deadline passed at @p now as ready
    */
-  template <typename Tile>
-  bool ready(TileCacheDelay<Tile> const& cache, TileId const& toFind) const
+  void expire(Clock::time_point now)
   {
-    return std::any_of(history_.begin(), history_.end(), [&toFind, &cache](ExpiringArea const& ea) {
-      return areaContainsTile(ea.area, toFind) && ea.ready(cache);
-    });
+    if (now < nextDeadline_)
+    {
+      return;
+    }
+
+    for (ExpiringArea& p : history_)
+    {
+      if (!p.ready && p.deadline <= now)
+      {
+        markReady(p);
+      }
+    }
+    updateNextDeadline();
+  }
+
+  void updateNextDeadline()
+  {
+    nextDeadline_ = Clock::time_point::max();
+    for (ExpiringArea const& p : history_)
+    {
+      if (!p.ready)
+      {
+        nextDeadline_ = std::min(nextDeadline_, p.deadline);
+      }
+    }
   }
+
+  /// History of areas that will be or were drawn in Rviz
+  std::vector<ExpiringArea> history_;
+  /// For each tile, the number of ready areas in `history_` which contain it
+  std::unordered_map<TileId, int> readyAreas_;
+  /// The earliest deadline of the areas which aren't ready
+  Clock::time_point nextDeadline_{ Clock::time_point::max() };
 };
 }  // namespace detail
 
@@ -133,40 +225,57 @@ public:
  * This is done by trying to load a whole square instead of just a single tile. The exact algorithm is as follows:
  *
  * Every time the robot enters a new center tile, request() is called. This functions stores the requested
- * detail::ExpiringArea, where a ExpiringArea is just an Area at a tile id with a timeout. Therefore we will collect a
- * history of Areas (detail::AreaHistory) while the robot moves.
+ * detail::ExpiringArea, where a ExpiringArea is just an Area with a deadline. Therefore we will collect a history of
+ * Areas (detail::AreaHistory) while the robot moves. The history counts the loaded tiles of each area when tiles are
+ * added to or removed from the cache, so that ready() doesn't have to check the areas.
  *
  * A tile will be drawn if it's ready(). A tile is ready() iff:
  * * it's successfully loaded from the file system or the internet, and
  * * either of the following things happened:
  *   * the tile is inside an Area which has all its tiles successfully loaded, or
- *   * the tile is inside an Area which expired, i.e. the Area was requested some seconds ago but not all tiles are
- *     loaded.
+ *   * the tile is inside an Area whose deadline passed, i.e. the Area was requested some seconds ago but not all tiles
+ *     are loaded.
  *
  * @warning Since TileCache isn't a virtual class, you shouldn't upcast a TileCacheDelay object to a TileCache object!
+ * request() and ready() only hide the methods of TileCache, so calling them through a `TileCache<Tile>&` bypasses the
+ * history, and the tiles are never delayed.
  */
 template <typename Tile>
 class TileCacheDelay : public TileCache<Tile>
 {
-  detail::AreaHistory history_;
-  friend detail::ExpiringArea;
+  /// guarded by `TileCache::cachedTilesLock`
+  detail::AreaHistory mutable history_;
 
 public:
-  void request(Area const& area)
+  TileCacheDelay()
   {
-    TileCache<Tile>::request(area);
+    this->onTileAdded = [this](TileId const& tileId) { history_.tileAdded(tileId); };
+    this->onTileRemoved = [this](TileId const& tileId) { history_.tileRemoved(tileId); };
+  }
 
-    history_.fit(area);
-    history_.add(area);
+  /**
+   * @see TileCache::request
+   */
+  void request(std::vector<Area> const& areas, std::vector<TileId> const& prefetch = {}, int fallbackLevels = 0)
+  {
+    TileCache<Tile>::request(areas, prefetch, fallbackLevels);
+
+    std::lock_guard<std::mutex> guard(this->cachedTilesLock);
+    history_.fit(areas);
+    for (Area const& area : areas)
+    {
+      history_.add(area, [this](TileId const& tileId) { return this->find(tileId) != nullptr; });
+    }
   }
 
   /**
-   * @note You have to use TileCacheGuard to guard this function call and the returned tile.
+   * @see TileCache::ready
    */
-  Tile const* ready(TileId const& toFind) const
+  std::shared_ptr<Tile const> ready(TileId const& toFind) const
   {
-    Tile const* tile = TileCache<Tile>::ready(toFind);
-    if (tile && history_.ready(*this, toFind))
+    std::lock_guard<std::mutex> guard(this->cachedTilesLock);
+    std::shared_ptr<Tile const> tile = this->find(toFind);
+    if (tile && history_.ready(toFind))
     {
       return tile;
     }
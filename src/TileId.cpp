@@ -14,24 +14,44 @@ limitations under the License. */
 
 #include "TileId.h"
 
+#include <mutex>
+#include <unordered_set>
+
 #include <boost/algorithm/string/replace.hpp>
-#include <boost/functional/hash/hash.hpp>
+
+namespace
+{
+/**
+ * Get the interned copy of @p url
+ */
+std::string const* intern(std::string const& url)
+{
+  static std::mutex lock;
+  // the elements of an unordered_set are never moved, so pointers to them stay valid
+  static std::unordered_set<std::string> urls;
+
+  std::lock_guard<std::mutex> guard(lock);
+  return &*urls.insert(url).first;
+}
+}  // namespace
+
+TileServer::TileServer() : url_(intern(std::string()))
+{
+}
+
+TileServer::TileServer(std::string const& url) : url_(intern(url))
+{
+}
 
 std::string tileURL(TileId const& tileId)
 {
-  auto url = tileId.tileServer;
+  auto url = tileId.tileServer.url();
   boost::replace_all(url, "{x}", std::to_string(tileId.coord.x));
   boost::replace_all(url, "{y}", std::to_string(tileId.coord.y));
   boost::replace_all(url, "{z}", std::to_string(tileId.zoom));
+  // Spread the tiles over the subdomains a, b and c, so that more connections can be opened in parallel. The subdomain
+  // of a tile never changes, since the disk cache is keyed by the URL.
+  char const subdomain[] = { static_cast<char>('a' + (tileId.coord.x + tileId.coord.y) % 3), '\0' };
+  boost::replace_all(url, "{s}", subdomain);
   return url;
 }
-
-size_t std::hash<TileId>::operator()(TileId const& tileId) const
-{
-  size_t seed{};
-  boost::hash_combine(seed, tileId.tileServer);
-  boost::hash_combine(seed, tileId.coord.x);
-  boost::hash_combine(seed, tileId.coord.y);
-  boost::hash_combine(seed, tileId.zoom);
-  return seed;
-}
@@ -17,12 +17,62 @@ limitations under the License. */
 #include <string>
 #include <tuple>
 #include <cstddef>
+#include <cstdint>
 #include <functional>
+#include <ostream>
 
 #include <QMetaType>
 
 #include "Coordinates.h"
 
+/**
+ * A handle to an interned tile server URL template
+ *
+ * Every URL template is stored once for the lifetime of the process, so that copying, comparing and hashing a
+ * TileServer doesn't touch the string. Only constructing a TileServer from a string looks it up.
+ *
+ * @note The constructor is thread-safe.
+ */
+class TileServer
+{
+public:
+  /// The empty tile server
+  TileServer();
+  explicit TileServer(std::string const& url);
+
+  /**
+   * The URL template, see tileURL
+   */
+  std::string const& url() const
+  {
+    return *url_;
+  }
+
+  bool empty() const
+  {
+    return url_->empty();
+  }
+
+  friend bool operator==(TileServer self, TileServer other)
+  {
+    return self.url_ == other.url_;
+  }
+
+  friend bool operator!=(TileServer self, TileServer other)
+  {
+    return self.url_ != other.url_;
+  }
+
+private:
+  /// points into the interned URLs, which are never freed
+  std::string const* url_;
+};
+
+inline std::ostream& operator<<(std::ostream& stream, TileServer tileServer)
+{
+  return stream << tileServer.url();
+}
+
 /**
  * All information to uniquely identify a tile at a tile server
  *
@@ -30,25 +80,72 @@ limitations under the License. */
  */
 struct TileId
 {
-  std::string tileServer;
+  TileServer tileServer;
   TileCoordinate coord;
   int zoom;
+
+  /**
+   * The zoom level and the coordinate packed into one integer, which identifies the tile at its tile server
+   *
+   * 5 bits hold the zoom level and 29 bits hold each tile coordinate, which is enough for all zoom levels up to
+   * maxZoom.
+   */
+  std::uint64_t key() const
+  {
+    static_assert(maxZoom < (1 << 5), "The zoom level has to fit into 5 bits");
+    std::uint64_t constexpr coordMask = (std::uint64_t{ 1 } << 29) - 1;
+    return static_cast<std::uint64_t>(zoom) << 58 | (static_cast<std::uint64_t>(coord.x) & coordMask) << 29 |
+           (static_cast<std::uint64_t>(coord.y) & coordMask);
+  }
 };
 
 namespace std
 {
+template <>
+struct hash<TileServer>
+{
+public:
+  size_t operator()(TileServer tileServer) const
+  {
+    return std::hash<std::string const*>()(&tileServer.url());
+  }
+};
+
 template <>
 struct hash<TileId>
 {
 public:
-  size_t operator()(TileId const& tileId) const;
+  size_t operator()(TileId const& tileId) const
+  {
+    // mix the bits of the key (splitmix64 finalizer), since neighboring tiles differ in the low bits of x and y only
+    std::uint64_t h = tileId.key() ^ static_cast<std::uint64_t>(std::hash<TileServer>()(tileId.tileServer));
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+    return static_cast<size_t>(h ^ (h >> 31));
+  }
 };
 }  // namespace std
 
 inline bool operator==(TileId const& self, TileId const& other)
 {
-  // optimization: check the tileServer last
-  return std::tie(self.coord, self.zoom, self.tileServer) == std::tie(other.coord, other.zoom, other.tileServer);
+  return self.key() == other.key() && self.tileServer == other.tileServer;
+}
+
+/**
+ * The tile @p levels zoom levels above @p tileId that covers it
+ */
+inline TileId ancestorOf(TileId const& tileId, int levels)
+{
+  return { tileId.tileServer, { tileId.coord.x >> levels, tileId.coord.y >> levels }, tileId.zoom - levels };
+}
+
+/**
+ * Is @p ancestor at a lower zoom level than @p tileId and does it cover @p tileId?
+ */
+inline bool isAncestor(TileId const& ancestor, TileId const& tileId)
+{
+  int const levels = tileId.zoom - ancestor.zoom;
+  return levels > 0 && ancestorOf(tileId, levels) == ancestor;
 }
 
 // Make type available for QVariant
@@ -56,5 +153,8 @@ Q_DECLARE_METATYPE(TileId)
 
 /**
  * Generate the URL to download a tile from
+ *
+ * The tokens {x}, {y} and {z} of the tile server are replaced by the tile coordinate and the zoom level, and {s} is
+ * replaced by one of the subdomains a, b or c.
  */
 std::string tileURL(TileId const& tileId);
@@ -0,0 +1,57 @@
+/* Copyright 2018-2019 TomTom N.V.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License. */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <utility>
+#include <QImage>
+#include "detail/ImagePool.h"
+
+/**
+ * A TileImage holds the decoded pixels of a tile in host memory.
+ *
+ * The pixels are uploaded into a TileAtlas when the tile gets drawn. When the tile is removed from the cache, its image
+ * buffer is returned to the detail::ImagePool, so that it can be reused for decoding another tile.
+ */
+struct TileImage
+{
+  /// a 32bit RGB image, see detail::decodeTileImage
+  QImage image;
+  /// when the tile was loaded into the cache, see rviz::AerialMapDisplay::updatePipelineStatus()
+  std::chrono::steady_clock::time_point loadedAt;
+
+  TileImage(QImage image_) : image(std::move(image_)), loadedAt(std::chrono::steady_clock::now())
+  {
+  }
+
+  ~TileImage()
+  {
+    detail::ImagePool::instance().release(std::move(image));
+  }
+
+  TileImage(TileImage&&) = default;
+  TileImage& operator=(TileImage&&) = default;
+  TileImage(TileImage const&) = delete;
+  TileImage& operator=(TileImage const&) = delete;
+
+  /**
+   * Host memory used by this tile, see TileCache
+   */
+  std::size_t byteCount() const
+  {
+    return static_cast<std::size_t>(image.byteCount());
+  }
+};
@@ -0,0 +1,162 @@
+/* Copyright 2018-2019 TomTom N.V.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License. */
+
+#include "TileMesh.h"
+
+#include <string>
+#include <vector>
+
+#include <OGRE/OgreHardwareBuffer.h>
+#include <OGRE/OgreManualObject.h>
+#include <OGRE/OgreSceneManager.h>
+#include <OGRE/OgreSceneNode.h>
+
+TileMesh::TileMesh(Ogre::SceneManager* scene_manager, Ogre::SceneNode* scene_node, TileAtlas const& atlas,
+                   int segments)
+  : scene_manager_(scene_manager), scene_node_(scene_node), atlas_(atlas), segments_(segments)
+{
+  // generate an unique name
+  static int count = 0;
+  std::string const name_suffix = std::to_string(count);
+  ++count;
+
+  object_ = scene_manager_->createManualObject("satellite_object_" + name_suffix);
+  // the vertices are updated frequently
+  object_->setDynamic(true);
+
+  std::size_t const vertices = verticesPerQuad();
+  Ogre::uint32 const row = segments_ + 1;
+  for (std::size_t page = 0; page < atlas_.pageCount(); ++page)
+  {
+    std::size_t const cells = atlas_.cellsInPage(page);
+    object_->estimateVertexCount(vertices * cells);
+    object_->estimateIndexCount(6 * segments_ * segments_ * cells);
+    object_->begin(atlas_.material(page)->getName(), Ogre::RenderOperation::OT_TRIANGLE_LIST);
+
+    for (std::size_t cell = 0; cell < cells; ++cell)
+    {
+      // all quads start hidden
+      for (std::size_t vertex = 0; vertex < vertices; ++vertex)
+      {
+        object_->position(0.0f, 0.0f, 0.0f);
+        object_->textureCoord(0.0f, 0.0f);
+        object_->normal(0.0f, 0.0f, 1.0f);
+      }
+
+      // the vertices of a grid are stored row by row, starting at the southern border, see terrainHeights()
+      auto const first = static_cast<Ogre::uint32>(vertices * cell);
+      for (Ogre::uint32 y = 0; y < static_cast<Ogre::uint32>(segments_); ++y)
+      {
+        for (Ogre::uint32 x = 0; x < static_cast<Ogre::uint32>(segments_); ++x)
+        {
+          Ogre::uint32 const south_west = first + y * row + x;
+          object_->quad(south_west, south_west + 1, south_west + row + 1, south_west + row);
+        }
+      }
+    }
+
+    object_->end();
+  }
+
+  scene_node_->attachObject(object_);
+}
+
+TileMesh::~TileMesh()
+{
+  scene_node_->detachObject(object_);
+  scene_manager_->destroyManualObject(object_);
+}
+
+void TileMesh::setQuad(std::size_t cell, double x, double y, double size, AtlasRect const& region,
+                       std::vector<float> const& heights)
+{
+  // Note: We flip the texture's v coordinate here instead of flipping the image, see AerialMapDisplay::assembleScene().
+  //
+  // Note that the Ogre texture coordinate system is: (0,0) = top left of the loaded image and (1,1) = bottom right
+  // of the loaded image, i.e. v = 0 is the northern border of a tile. The texture coordinates are restricted to the
+  // region of the tile's cell in the atlas.
+  AtlasRect const rect = atlas_.cellRect(cell);
+  float const u0 = rect.u0 + region.u0 * (rect.u1 - rect.u0);
+  float const u1 = rect.u0 + region.u1 * (rect.u1 - rect.u0);
+  float const v_south = rect.v0 + (1 - region.v0) * (rect.v1 - rect.v0);
+  float const v_north = rect.v0 + (1 - region.v1) * (rect.v1 - rect.v0);
+
+  std::size_t const vertices = verticesPerQuad();
+  std::vector<Ogre::Vector3> positions;
+  std::vector<Ogre::Vector2> uvs;
+  positions.reserve(vertices);
+  uvs.reserve(vertices);
+
+  // from the south-western to the north-eastern corner, row by row
+  for (int row = 0; row <= segments_; ++row)
+  {
+    float const fy = static_cast<float>(row) / segments_;
+    for (int column = 0; column <= segments_; ++column)
+    {
+      float const fx = static_cast<float>(column) / segments_;
+      float const z = heights.empty() ? 0.0f : heights[positions.size()];
+      positions.emplace_back(static_cast<float>(x + fx * size), static_cast<float>(y + fy * size), z);
+      uvs.emplace_back(u0 + fx * (u1 - u0), v_south + fy * (v_north - v_south));
+    }
+  }
+  writeQuad(cell, positions, uvs);
+}
+
+void TileMesh::hideQuad(std::size_t cell)
+{
+  std::size_t const vertices = verticesPerQuad();
+  writeQuad(cell, std::vector<Ogre::Vector3>(vertices, Ogre::Vector3::ZERO),
+            std::vector<Ogre::Vector2>(vertices, Ogre::Vector2::ZERO));
+}
+
+void TileMesh::setBoundingBox(Ogre::AxisAlignedBox const& box)
+{
+  object_->setBoundingBox(box);
+}
+
+void TileMesh::writeQuad(std::size_t cell, std::vector<Ogre::Vector3> const& positions,
+                         std::vector<Ogre::Vector2> const& uvs)
+{
+  Ogre::VertexData* vertex_data = object_->getSection(atlas_.pageOf(cell))->getRenderOperation()->vertexData;
+  Ogre::VertexDeclaration const* declaration = vertex_data->vertexDeclaration;
+  Ogre::HardwareVertexBufferSharedPtr const buffer = vertex_data->vertexBufferBinding->getBuffer(0);
+
+  Ogre::VertexElement const* position = declaration->findElementBySemantic(Ogre::VES_POSITION);
+  Ogre::VertexElement const* texture_coord = declaration->findElementBySemantic(Ogre::VES_TEXTURE_COORDINATES);
+  Ogre::VertexElement const* normal = declaration->findElementBySemantic(Ogre::VES_NORMAL);
+  std::size_t const vertex_size = declaration->getVertexSize(0);
+
+  std::vector<unsigned char> data(positions.size() * vertex_size);
+  for (std::size_t i = 0; i < positions.size(); ++i)
+  {
+    unsigned char* vertex = data.data() + i * vertex_size;
+    float* element;
+
+    position->baseVertexPointerToElement(vertex, &element);
+    element[0] = positions[i].x;
+    element[1] = positions[i].y;
+    element[2] = positions[i].z;
+
+    texture_coord->baseVertexPointerToElement(vertex, &element);
+    element[0] = uvs[i].x;
+    element[1] = uvs[i].y;
+
+    normal->baseVertexPointerToElement(vertex, &element);
+    element[0] = 0.0f;
+    element[1] = 0.0f;
+    element[2] = 1.0f;
+  }
+
+  buffer->writeData(atlas_.indexInPage(cell) * data.size(), data.size(), data.data());
+}
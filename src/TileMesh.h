@@ -0,0 +1,103 @@
+/* Copyright 2018-2019 TomTom N.V.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License. */
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include <OGRE/OgreAxisAlignedBox.h>
+#include <OGRE/OgreVector2.h>
+
+#include "TileAtlas.h"
+
+namespace Ogre
+{
+class ManualObject;
+class SceneManager;
+class SceneNode;
+}  // namespace Ogre
+
+/**
+ * The geometry of a grid of tiles whose textures are stored in a TileAtlas.
+ *
+ * Every cell of the atlas has its own quad, and all quads of a page are stored in one section of a Ogre::ManualObject.
+ * The section layout never changes, so a quad can be updated on its own without rebuilding the whole mesh. Hidden
+ * quads are degenerated to a point.
+ *
+ * To drape the tiles on a terrain, each quad can be a grid of `segments` x `segments` squares whose vertices have
+ * individual heights. All grids have the same topology, so the indices are written once when the mesh is created and
+ * only the vertices are updated afterwards.
+ */
+class TileMesh
+{
+public:
+  /**
+   * Create the mesh and attach it to @p scene_node
+   *
+   * @param segments the number of grid segments along each border of a quad, 1 if the quads are always flat
+   */
+  TileMesh(Ogre::SceneManager* scene_manager, Ogre::SceneNode* scene_node, TileAtlas const& atlas, int segments = 1);
+  ~TileMesh();
+
+  TileMesh(TileMesh const&) = delete;
+  TileMesh& operator=(TileMesh const&) = delete;
+
+  /**
+   * Show the texture of the cell @p cell on the square with the bottom left corner (@p x, @p y) and the width/ height
+   * @p size
+   *
+   * @param region the part of the cell's texture to show, in texture coordinates relative to the cell, but with v = 0
+   * at the southern border of the tile
+   * @param heights the height of each vertex of the quad's grid (see terrainHeights()), or empty for a flat quad at
+   * the height 0
+   */
+  void setQuad(std::size_t cell, double x, double y, double size, AtlasRect const& region = { 0, 0, 1, 1 },
+               std::vector<float> const& heights = {});
+
+  /**
+   * Hide the quad of the cell @p cell
+   */
+  void hideQuad(std::size_t cell);
+
+  /**
+   * Set the bounds of the mesh. They aren't computed automatically when quads are updated.
+   */
+  void setBoundingBox(Ogre::AxisAlignedBox const& box);
+
+  Ogre::ManualObject* object() const
+  {
+    return object_;
+  }
+
+private:
+  /**
+   * Number of vertices of the grid of a quad
+   */
+  std::size_t verticesPerQuad() const
+  {
+    return static_cast<std::size_t>((segments_ + 1) * (segments_ + 1));
+  }
+
+  /**
+   * Overwrite the vertices of the quad of cell @p cell in the vertex buffer of its section
+   */
+  void writeQuad(std::size_t cell, std::vector<Ogre::Vector3> const& positions, std::vector<Ogre::Vector2> const& uvs);
+
+  Ogre::SceneManager* scene_manager_;
+  Ogre::SceneNode* scene_node_;
+  TileAtlas const& atlas_;
+  int segments_;
+  Ogre::ManualObject* object_;
+};
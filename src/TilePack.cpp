@@ -0,0 +1,187 @@
+/* Copyright 2018-2019 TomTom N.V.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License. */
+
+#include "TilePack.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#include <QDataStream>
+#include <QSaveFile>
+#include <QtEndian>
+
+#include "General.h"
+
+constexpr char TilePack::magic[];
+
+TilePack::TilePack(QString const& path) : file_(path), levels_(maxZoom + 1, Level{ 0, 0, 0, 0, 0 })
+{
+  if (!file_.open(QIODevice::ReadOnly))
+  {
+    throw std::runtime_error("Unable to open tile pack " + path.toStdString() + ": " +
+                             file_.errorString().toStdString());
+  }
+
+  size_ = static_cast<quint64>(file_.size());
+  data_ = size_ >= headerSize ? file_.map(0, file_.size()) : nullptr;
+  if (!data_ || std::memcmp(data_, magic, magicSize) != 0)
+  {
+    throw std::runtime_error(path.toStdString() + " is not a tile pack");
+  }
+
+  if (qFromLittleEndian<quint32>(data_ + 8) != version)
+  {
+    throw std::runtime_error("Unsupported version of tile pack " + path.toStdString());
+  }
+
+  quint64 const levelCount = qFromLittleEndian<quint32>(data_ + 12);
+  if (headerSize + levelCount * levelRecordSize > size_)
+  {
+    throw std::runtime_error("Truncated tile pack " + path.toStdString());
+  }
+
+  for (quint64 i = 0; i < levelCount; ++i)
+  {
+    uchar const* record = data_ + headerSize + i * levelRecordSize;
+    quint32 const zoom = qFromLittleEndian<quint32>(record);
+    Level const level{ qFromLittleEndian<quint32>(record + 4), qFromLittleEndian<quint32>(record + 8),
+                       qFromLittleEndian<quint32>(record + 12), qFromLittleEndian<quint32>(record + 16),
+                       qFromLittleEndian<quint64>(record + 24) };
+
+    quint64 const indexSize = static_cast<quint64>(level.columns) * level.rows * indexEntrySize;
+    if (zoom > static_cast<quint32>(maxZoom) || level.indexOffset > size_ || indexSize > size_ - level.indexOffset)
+    {
+      throw std::runtime_error("Invalid zoom level " + std::to_string(zoom) + " in tile pack " + path.toStdString());
+    }
+
+    levels_[zoom] = level;
+  }
+}
+
+QByteArray TilePack::tile(TileCoordinate const& coord, int zoom) const
+{
+  if (zoom < 0 || zoom > maxZoom)
+  {
+    return QByteArray();
+  }
+
+  Level const& level = levels_[zoom];
+  // unsigned arithmetic, so coordinates left of/ above the rectangle wrap around and are rejected as well
+  quint32 const column = static_cast<quint32>(coord.x) - level.minX;
+  quint32 const row = static_cast<quint32>(coord.y) - level.minY;
+  if (column >= level.columns || row >= level.rows)
+  {
+    return QByteArray();
+  }
+
+  quint64 const index = static_cast<quint64>(row) * level.columns + column;
+  uchar const* entry = data_ + level.indexOffset + index * indexEntrySize;
+  quint64 const offset = qFromLittleEndian<quint64>(entry);
+  quint32 const size = qFromLittleEndian<quint32>(entry + 8);
+  if (size == 0 || offset > size_ || size > size_ - offset)
+  {
+    return QByteArray();
+  }
+
+  return QByteArray::fromRawData(reinterpret_cast<char const*>(data_ + offset), static_cast<int>(size));
+}
+
+void TilePackWriter::add(TileCoordinate const& coord, int zoom, QByteArray data)
+{
+  tiles_[std::make_tuple(zoom, coord.y, coord.x)] = std::move(data);
+}
+
+void TilePackWriter::write(QString const& path) const
+{
+  struct LevelBounds
+  {
+    int zoom, minX, minY, maxX, maxY;
+  };
+  std::vector<LevelBounds> levels;
+  for (auto const& tile : tiles_)
+  {
+    int const zoom = std::get<0>(tile.first);
+    int const y = std::get<1>(tile.first);
+    int const x = std::get<2>(tile.first);
+    if (levels.empty() || levels.back().zoom != zoom)
+    {
+      levels.push_back({ zoom, x, y, x, y });
+    }
+    LevelBounds& level = levels.back();
+    level.minX = std::min(level.minX, x);
+    level.minY = std::min(level.minY, y);
+    level.maxX = std::max(level.maxX, x);
+    level.maxY = std::max(level.maxY, y);
+  }
+
+  QSaveFile file(path);
+  if (!file.open(QIODevice::WriteOnly))
+  {
+    throw std::runtime_error("Unable to write tile pack " + path.toStdString() + ": " +
+                             file.errorString().toStdString());
+  }
+
+  QDataStream stream(&file);
+  stream.setByteOrder(QDataStream::LittleEndian);
+
+  stream.writeRawData(TilePack::magic, TilePack::magicSize);
+  stream << TilePack::version << static_cast<quint32>(levels.size());
+
+  // the indices follow the level records, and the tile data follows the indices
+  quint64 offset = TilePack::headerSize + levels.size() * TilePack::levelRecordSize;
+  for (LevelBounds const& level : levels)
+  {
+    quint32 const columns = level.maxX - level.minX + 1;
+    quint32 const rows = level.maxY - level.minY + 1;
+    stream << static_cast<quint32>(level.zoom) << static_cast<quint32>(level.minX) << static_cast<quint32>(level.minY)
+           << columns << rows << quint32(0) << offset;
+    offset += static_cast<quint64>(columns) * rows * TilePack::indexEntrySize;
+  }
+
+  for (LevelBounds const& level : levels)
+  {
+    for (int y = level.minY; y <= level.maxY; ++y)
+    {
+      for (int x = level.minX; x <= level.maxX; ++x)
+      {
+        auto const it = tiles_.find(std::make_tuple(level.zoom, y, x));
+        if (it == tiles_.end() || it->second.isEmpty())
+        {
+          stream << quint64(0) << quint32(0) << quint32(0);
+          continue;
+        }
+
+        if (static_cast<quint64>(it->second.size()) > std::numeric_limits<quint32>::max())
+        {
+          throw std::runtime_error("Tile too large for tile pack " + path.toStdString());
+        }
+        stream << offset << static_cast<quint32>(it->second.size()) << quint32(0);
+        offset += it->second.size();
+      }
+    }
+  }
+
+  for (auto const& tile : tiles_)
+  {
+    stream.writeRawData(tile.second.constData(), tile.second.size());
+  }
+
+  if (stream.status() != QDataStream::Ok || !file.commit())
+  {
+    throw std::runtime_error("Unable to write tile pack " + path.toStdString() + ": " +
+                             file.errorString().toStdString());
+  }
+}
@@ -0,0 +1,132 @@
+/* Copyright 2018-2019 TomTom N.V.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License. */
+
+#pragma once
+
+#include <cstddef>
+#include <map>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include <QByteArray>
+#include <QFile>
+#include <QString>
+
+#include "Coordinates.h"
+
+/**
+ * Is the Object URI @p uri a tile pack, i.e. `tilepack://` followed by the path of the pack file?
+ *
+ * @see TilePack
+ */
+inline bool isTilePackUri(std::string const& uri)
+{
+  return uri.compare(0, 11, "tilepack://") == 0;
+}
+
+/**
+ * The path of the pack file of the tile pack URI @p uri, e.g. "/data/campus.tilepack" for
+ * "tilepack:///data/campus.tilepack"
+ */
+inline std::string tilePackPath(std::string const& uri)
+{
+  return uri.substr(11);
+}
+
+/**
+ * A read-only archive of encoded tiles (e.g. PNG or JPEG) of one tile source, stored in a single file which is
+ * memory-mapped.
+ *
+ * Unlike the QNetworkDiskCache, which stores one file with HTTP metadata per tile, a pack is provisioned by copying one
+ * file and a tile is found in constant time. For every zoom level, the pack has a dense index over the bounding
+ * rectangle of its tiles.
+ *
+ * The file consists of the following parts, all integers are unsigned and little-endian:
+ *
+ * * header: `char magic[8]` ("RVSATPAK"), `uint32 version` (1) and `uint32 levelCount`
+ * * levelCount level records: `uint32 zoom, minX, minY, columns, rows, reserved` and `uint64 indexOffset`, the file
+ *   offset of the level's index
+ * * per level, an index of columns * rows entries in row-major order: `uint64 offset, uint32 size, uint32 reserved`,
+ *   the file offset and size of the tile data. Missing tiles have the size 0.
+ * * the tile data
+ */
+class TilePack
+{
+public:
+  static constexpr char magic[] = "RVSATPAK";
+  static constexpr std::size_t magicSize = 8;
+  static constexpr quint32 version = 1;
+  static constexpr std::size_t headerSize = 16;
+  static constexpr std::size_t levelRecordSize = 32;
+  static constexpr std::size_t indexEntrySize = 16;
+
+  /**
+   * Open and map the pack file at @p path
+   * @throws std::runtime_error if the file can't be mapped or isn't a valid pack
+   */
+  explicit TilePack(QString const& path);
+
+  TilePack(TilePack const&) = delete;
+  TilePack& operator=(TilePack const&) = delete;
+
+  /**
+   * The encoded data of the tile at @p coord and @p zoom
+   *
+   * The data isn't copied, it refers to the mapped file. Therefore it is only valid as long as this pack exists.
+   * @return the tile data, or a null byte array if the pack doesn't contain the tile
+   */
+  QByteArray tile(TileCoordinate const& coord, int zoom) const;
+
+private:
+  struct Level
+  {
+    quint32 minX, minY, columns, rows;
+    quint64 indexOffset;
+  };
+
+  QFile file_;
+  uchar const* data_;
+  quint64 size_;
+  /// indexed by zoom level, levels without tiles have no columns
+  std::vector<Level> levels_;
+};
+
+/**
+ * Collects encoded tiles and writes them into a tile pack file, see TilePack
+ */
+class TilePackWriter
+{
+public:
+  /**
+   * Add the encoded @p data of the tile at @p coord and @p zoom. A tile that was added before is replaced.
+   */
+  void add(TileCoordinate const& coord, int zoom, QByteArray data);
+
+  std::size_t tileCount() const
+  {
+    return tiles_.size();
+  }
+
+  /**
+   * Write all added tiles into a new pack file at @p path
+   * @throws std::runtime_error if the file can't be written
+   */
+  void write(QString const& path) const;
+
+private:
+  /// the tiles by (zoom, y, x), i.e. in the order of the pack's indices
+  std::map<std::tuple<int, int, int>, QByteArray> tiles_;
+};
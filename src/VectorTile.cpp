@@ -0,0 +1,430 @@
+/* Copyright 2018-2019 TomTom N.V.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License. */
+
+#include "VectorTile.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <QColor>
+#include <QPainter>
+#include <QPainterPath>
+#include <QPen>
+#include <QUrl>
+
+#include "detail/ImagePool.h"
+
+namespace
+{
+/**
+ * Minimal reader of the protobuf wire format, which is all that vector tiles need
+ *
+ * @see https://developers.google.com/protocol-buffers/docs/encoding
+ */
+class ProtobufReader
+{
+public:
+  enum WireType
+  {
+    Varint = 0,
+    Fixed64 = 1,
+    LengthDelimited = 2,
+    Fixed32 = 5
+  };
+
+  ProtobufReader(char const* begin, char const* end) : pos_(begin), end_(end)
+  {
+  }
+
+  /**
+   * Read the key of the next field
+   * @return false at the end of the message
+   */
+  bool next()
+  {
+    if (pos_ == end_)
+    {
+      return false;
+    }
+
+    std::uint64_t const key = varint();
+    field_ = static_cast<std::uint32_t>(key >> 3);
+    wireType_ = static_cast<int>(key & 0x7);
+    return true;
+  }
+
+  std::uint32_t field() const
+  {
+    return field_;
+  }
+
+  int wireType() const
+  {
+    return wireType_;
+  }
+
+  std::uint64_t varint()
+  {
+    std::uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+      if (pos_ == end_)
+      {
+        throw std::runtime_error("Truncated varint");
+      }
+
+      auto const byte = static_cast<std::uint8_t>(*pos_++);
+      value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+      if ((byte & 0x80) == 0)
+      {
+        return value;
+      }
+    }
+    throw std::runtime_error("Varint too long");
+  }
+
+  /**
+   * Read a length-delimited field, e.g. a string, an embedded message or a packed repeated field
+   */
+  ProtobufReader message()
+  {
+    std::uint64_t const size = varint();
+    if (size > static_cast<std::uint64_t>(end_ - pos_))
+    {
+      throw std::runtime_error("Truncated field");
+    }
+
+    ProtobufReader nested(pos_, pos_ + size);
+    pos_ += size;
+    return nested;
+  }
+
+  std::string string()
+  {
+    ProtobufReader const nested = message();
+    return std::string(nested.pos_, nested.end_);
+  }
+
+  bool atEnd() const
+  {
+    return pos_ == end_;
+  }
+
+  /**
+   * Skip the value of the current field
+   */
+  void skip()
+  {
+    switch (wireType_)
+    {
+      case Varint:
+        varint();
+        break;
+      case Fixed64:
+        advance(8);
+        break;
+      case LengthDelimited:
+        message();
+        break;
+      case Fixed32:
+        advance(4);
+        break;
+      default:
+        throw std::runtime_error("Unsupported wire type " + std::to_string(wireType_));
+    }
+  }
+
+private:
+  void advance(std::ptrdiff_t bytes)
+  {
+    if (bytes > end_ - pos_)
+    {
+      throw std::runtime_error("Truncated field");
+    }
+    pos_ += bytes;
+  }
+
+  char const* pos_;
+  char const* end_;
+  std::uint32_t field_{ 0 };
+  int wireType_{ Varint };
+};
+
+std::int32_t zigzag(std::uint32_t value)
+{
+  return static_cast<std::int32_t>(value >> 1) ^ -static_cast<std::int32_t>(value & 1);
+}
+
+/**
+ * Decode the geometry commands of a feature
+ *
+ * @see https://github.com/mapbox/vector-tile-spec/tree/master/2.1#43-geometry-encoding
+ */
+std::vector<std::vector<QPointF>> decodeGeometry(std::vector<std::uint32_t> const& commands)
+{
+  enum Command
+  {
+    MoveTo = 1,
+    LineTo = 2,
+    ClosePath = 7
+  };
+
+  std::vector<std::vector<QPointF>> parts;
+  // the cursor isn't reset between the parts
+  std::int32_t x = 0;
+  std::int32_t y = 0;
+
+  for (std::size_t i = 0; i < commands.size();)
+  {
+    std::uint32_t const command = commands[i] & 0x7;
+    std::uint32_t const count = commands[i] >> 3;
+    ++i;
+
+    if (command == ClosePath)
+    {
+      if (!parts.empty() && !parts.back().empty())
+      {
+        parts.back().push_back(parts.back().front());
+      }
+      continue;
+    }
+    if (command != MoveTo && command != LineTo)
+    {
+      throw std::runtime_error("Unknown geometry command " + std::to_string(command));
+    }
+    if (count > (commands.size() - i) / 2)
+    {
+      throw std::runtime_error("Truncated geometry");
+    }
+
+    for (std::uint32_t n = 0; n < count; ++n, i += 2)
+    {
+      x += zigzag(commands[i]);
+      y += zigzag(commands[i + 1]);
+
+      // every point of a multi point starts a new part, just like the start of a line or ring
+      if (command == MoveTo || parts.empty())
+      {
+        parts.emplace_back();
+      }
+      parts.back().emplace_back(x, y);
+    }
+  }
+  return parts;
+}
+
+std::vector<std::uint32_t> readPacked(ProtobufReader& reader)
+{
+  std::vector<std::uint32_t> values;
+  if (reader.wireType() != ProtobufReader::LengthDelimited)
+  {
+    // a single unpacked element
+    values.push_back(static_cast<std::uint32_t>(reader.varint()));
+    return values;
+  }
+
+  ProtobufReader packed = reader.message();
+  while (!packed.atEnd())
+  {
+    values.push_back(static_cast<std::uint32_t>(packed.varint()));
+  }
+  return values;
+}
+
+VectorTileFeature parseFeature(ProtobufReader reader)
+{
+  VectorTileFeature feature{ VectorTileFeature::Type::Unknown, {} };
+  std::vector<std::uint32_t> geometry;
+  while (reader.next())
+  {
+    if (reader.field() == 3 && reader.wireType() == ProtobufReader::Varint)
+    {
+      std::uint64_t const type = reader.varint();
+      feature.type = type <= 3 ? static_cast<VectorTileFeature::Type>(type) : VectorTileFeature::Type::Unknown;
+    }
+    else if (reader.field() == 4)
+    {
+      std::vector<std::uint32_t> const commands = readPacked(reader);
+      geometry.insert(geometry.end(), commands.begin(), commands.end());
+    }
+    else
+    {
+      reader.skip();
+    }
+  }
+
+  feature.parts = decodeGeometry(geometry);
+  return feature;
+}
+
+VectorTileLayer parseLayer(ProtobufReader reader)
+{
+  VectorTileLayer layer{ std::string(), 4096, {} };
+  while (reader.next())
+  {
+    if (reader.field() == 1 && reader.wireType() == ProtobufReader::LengthDelimited)
+    {
+      layer.name = reader.string();
+    }
+    else if (reader.field() == 2 && reader.wireType() == ProtobufReader::LengthDelimited)
+    {
+      layer.features.push_back(parseFeature(reader.message()));
+    }
+    else if (reader.field() == 5 && reader.wireType() == ProtobufReader::Varint)
+    {
+      layer.extent = static_cast<std::uint32_t>(reader.varint());
+    }
+    else
+    {
+      reader.skip();
+    }
+  }
+
+  if (layer.extent == 0)
+  {
+    throw std::runtime_error("Layer " + layer.name + " has no extent");
+  }
+  return layer;
+}
+
+/**
+ * How to draw the features of a layer
+ */
+struct LayerStyle
+{
+  /// layer names of the OpenMapTiles and Mapbox Streets schemas
+  std::vector<std::string> names;
+  /// fill of polygons, transparent for none
+  QColor fill;
+  /// outline of polygons and color of lines
+  QColor line;
+  /// width of lines in pixels at a tile size of 256 pixels
+  qreal lineWidth;
+};
+
+/**
+ * The styles in the order they are drawn
+ */
+std::vector<LayerStyle> const& layerStyles()
+{
+  static std::vector<LayerStyle> const styles = {
+    { { "landcover", "landuse", "landuse_overlay" }, QColor(0xd8, 0xe8, 0xc8), Qt::transparent, 0 },
+    { { "park" }, QColor(0xc8, 0xdf, 0xb0), Qt::transparent, 0 },
+    { { "water" }, QColor(0xaa, 0xd3, 0xdf), Qt::transparent, 0 },
+    { { "waterway" }, Qt::transparent, QColor(0xaa, 0xd3, 0xdf), 1.5 },
+    { { "aeroway" }, QColor(0xe9, 0xe7, 0xe2), QColor(0xc0, 0xbe, 0xb8), 1.0 },
+    { { "building" }, QColor(0xd9, 0xd0, 0xc9), QColor(0xc4, 0xb6, 0xab), 0.5 },
+    { { "transportation", "road", "bridge", "tunnel" }, Qt::transparent, QColor(0xff, 0xff, 0xff), 2.0 },
+    { { "boundary", "admin" }, Qt::transparent, QColor(0x9e, 0x9c, 0xab), 1.0 },
+  };
+  return styles;
+}
+
+QColor const background(0xf2, 0xef, 0xe9);
+
+void drawLayer(QPainter& painter, VectorTileLayer const& layer, LayerStyle const& style, int size)
+{
+  qreal const scale = static_cast<qreal>(size) / layer.extent;
+
+  for (VectorTileFeature const& feature : layer.features)
+  {
+    if (feature.type == VectorTileFeature::Type::Polygon && style.fill.alpha() > 0)
+    {
+      // odd-even filling cuts out the interior rings
+      QPainterPath path;
+      path.setFillRule(Qt::OddEvenFill);
+      for (std::vector<QPointF> const& ring : feature.parts)
+      {
+        if (ring.size() < 3)
+        {
+          continue;
+        }
+        path.moveTo(ring.front() * scale);
+        for (std::size_t i = 1; i < ring.size(); ++i)
+        {
+          path.lineTo(ring[i] * scale);
+        }
+        path.closeSubpath();
+      }
+
+      painter.setPen(style.line.alpha() > 0 ? QPen(style.line, style.lineWidth * size / 256) : QPen(Qt::NoPen));
+      painter.setBrush(style.fill);
+      painter.drawPath(path);
+    }
+    else if ((feature.type == VectorTileFeature::Type::LineString ||
+              feature.type == VectorTileFeature::Type::Polygon) &&
+             style.line.alpha() > 0)
+    {
+      QPen pen(style.line, style.lineWidth * size / 256);
+      pen.setCapStyle(Qt::RoundCap);
+      pen.setJoinStyle(Qt::RoundJoin);
+      painter.setPen(pen);
+      painter.setBrush(Qt::NoBrush);
+
+      for (std::vector<QPointF> const& line : feature.parts)
+      {
+        std::vector<QPointF> scaled(line.size());
+        std::transform(line.begin(), line.end(), scaled.begin(), [scale](QPointF const& p) { return p * scale; });
+        painter.drawPolyline(scaled.data(), static_cast<int>(scaled.size()));
+      }
+    }
+  }
+}
+}  // namespace
+
+bool isVectorTileUri(std::string const& url)
+{
+  QString const path = QUrl(QString::fromStdString(url)).path();
+  return path.endsWith(".mvt", Qt::CaseInsensitive) || path.endsWith(".pbf", Qt::CaseInsensitive);
+}
+
+std::vector<VectorTileLayer> parseVectorTile(QByteArray const& data)
+{
+  std::vector<VectorTileLayer> layers;
+  ProtobufReader reader(data.constData(), data.constData() + data.size());
+  while (reader.next())
+  {
+    if (reader.field() == 3 && reader.wireType() == ProtobufReader::LengthDelimited)
+    {
+      layers.push_back(parseLayer(reader.message()));
+    }
+    else
+    {
+      reader.skip();
+    }
+  }
+  return layers;
+}
+
+QImage renderVectorTile(std::vector<VectorTileLayer> const& layers, int size)
+{
+  QImage image = detail::ImagePool::instance().acquire(QSize(size, size), QImage::Format_RGB32);
+  image.fill(background);
+
+  {
+    QPainter painter(&image);
+    painter.setRenderHint(QPainter::Antialiasing);
+    for (LayerStyle const& style : layerStyles())
+    {
+      for (VectorTileLayer const& layer : layers)
+      {
+        if (std::find(style.names.begin(), style.names.end(), layer.name) != style.names.end())
+        {
+          drawLayer(painter, layer, style, size);
+        }
+      }
+    }
+  }
+  return image;
+}
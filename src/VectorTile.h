@@ -0,0 +1,78 @@
+/* Copyright 2018-2019 TomTom N.V.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License. */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <QByteArray>
+#include <QImage>
+#include <QPointF>
+
+/**
+ * Does the tile URL template @p url refer to Mapbox Vector Tiles, i.e. does its path end with `.mvt` or `.pbf`?
+ *
+ * @see https://github.com/mapbox/vector-tile-spec
+ */
+bool isVectorTileUri(std::string const& url);
+
+/**
+ * A feature of a vector tile layer, in the tile coordinates of its layer (0 - extent, y grows southwards)
+ */
+struct VectorTileFeature
+{
+  enum class Type
+  {
+    Unknown = 0,
+    Point = 1,
+    LineString = 2,
+    Polygon = 3
+  };
+
+  Type type;
+  /// The points, lines or rings of the feature. The rings of a polygon are in their original order, so that the
+  /// interior rings follow their exterior ring.
+  std::vector<std::vector<QPointF>> parts;
+};
+
+/**
+ * A layer of a vector tile, e.g. "water" or "building"
+ */
+struct VectorTileLayer
+{
+  std::string name;
+  std::uint32_t extent;
+  std::vector<VectorTileFeature> features;
+};
+
+/**
+ * Parse an uncompressed vector tile, i.e. a `vector_tile.Tile` protobuf message
+ *
+ * The attributes of the features are skipped, since they aren't used for rendering.
+ *
+ * @throws std::runtime_error if the data isn't a valid vector tile
+ */
+std::vector<VectorTileLayer> parseVectorTile(QByteArray const& data);
+
+/**
+ * Rasterize the @p layers into a 32bit RGB image of @p size x @p size pixels, see TileAtlas
+ *
+ * Layers are drawn with a built-in style by their name, following the OpenMapTiles and Mapbox Streets schemas.
+ * Layers without a style (e.g. labels) are skipped.
+ *
+ * @note This function is thread-safe, it renders without a GUI context.
+ */
+QImage renderVectorTile(std::vector<VectorTileLayer> const& layers, int size);
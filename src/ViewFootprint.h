@@ -0,0 +1,159 @@
+/* Copyright 2018-2019 TomTom N.V.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License. */
+
+#pragma once
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#include <boost/optional.hpp>
+
+#include <OGRE/OgreRay.h>
+#include <OGRE/OgreVector2.h>
+
+/**
+ * The part of the map plane z = 0 that the camera sees, see viewFootprint()
+ */
+struct ViewFootprint
+{
+  /// the visible part of the plane, a convex polygon in counter-clockwise order
+  std::vector<Ogre::Vector2> polygon;
+  /// the visible point nearest to the camera, i.e. where the map is seen in most detail
+  Ogre::Vector2 focus;
+};
+
+namespace detail
+{
+/**
+ * The convex hull of the @p points in counter-clockwise order (Andrew's monotone chain)
+ */
+inline std::vector<Ogre::Vector2> convexHull(std::vector<Ogre::Vector2> points)
+{
+  std::sort(points.begin(), points.end(), [](Ogre::Vector2 const& a, Ogre::Vector2 const& b) {
+    return a.x < b.x || (a.x == b.x && a.y < b.y);
+  });
+  if (points.size() < 3)
+  {
+    return points;
+  }
+
+  // the lower hull from left to right, then the upper hull from right to left
+  std::vector<Ogre::Vector2> hull(2 * points.size());
+  std::size_t k = 0;
+  auto const add = [&hull, &k](Ogre::Vector2 const& point, std::size_t min) {
+    while (k >= min && (hull[k - 1] - hull[k - 2]).crossProduct(point - hull[k - 2]) <= 0)
+    {
+      --k;
+    }
+    hull[k++] = point;
+  };
+  for (std::size_t i = 0; i < points.size(); ++i)
+  {
+    add(points[i], 2);
+  }
+  std::size_t const lower = k + 1;
+  for (std::size_t i = points.size() - 1; i-- > 0;)
+  {
+    add(points[i], lower);
+  }
+
+  // the last point is the first one
+  hull.resize(k - 1);
+  return hull;
+}
+
+/**
+ * The point of the convex @p polygon (counter-clockwise) nearest to @p point
+ */
+inline Ogre::Vector2 nearestPointInPolygon(std::vector<Ogre::Vector2> const& polygon, Ogre::Vector2 const& point)
+{
+  bool inside = true;
+  Ogre::Vector2 nearest = polygon.front();
+  float nearest_distance = std::numeric_limits<float>::max();
+  for (std::size_t i = 0; i < polygon.size(); ++i)
+  {
+    Ogre::Vector2 const& a = polygon[i];
+    Ogre::Vector2 const& b = polygon[(i + 1) % polygon.size()];
+    Ogre::Vector2 const edge = b - a;
+    inside = inside && edge.crossProduct(point - a) >= 0;
+
+    float const t = std::min(std::max((point - a).dotProduct(edge) / edge.squaredLength(), 0.0f), 1.0f);
+    Ogre::Vector2 const candidate = a + t * edge;
+    float const distance = candidate.squaredDistance(point);
+    if (distance < nearest_distance)
+    {
+      nearest = candidate;
+      nearest_distance = distance;
+    }
+  }
+  return inside ? point : nearest;
+}
+}  // namespace detail
+
+/**
+ * Intersect the @p rays through the corners of the viewport with the map plane z = 0
+ *
+ * Rays which pass above the horizon, and rays which hit the plane further away than @p maxDistance from the point
+ * below the camera, are cut at that distance. The heights of the terrain are ignored.
+ *
+ * @param rays the rays in the frame of the map plane
+ * @return the visible part of the plane, or none if the camera doesn't see the plane at all
+ */
+inline boost::optional<ViewFootprint> viewFootprint(std::vector<Ogre::Ray> const& rays, float maxDistance)
+{
+  std::vector<Ogre::Vector2> points;
+  bool hits = false;
+  Ogre::Vector2 ground = Ogre::Vector2::ZERO;
+  for (Ogre::Ray const& ray : rays)
+  {
+    Ogre::Vector3 const& origin = ray.getOrigin();
+    Ogre::Vector3 const& direction = ray.getDirection();
+    ground = { origin.x, origin.y };
+
+    Ogre::Vector2 offset;
+    if (origin.z * direction.z < 0)
+    {
+      Ogre::Vector3 const hit = ray.getPoint(-origin.z / direction.z);
+      offset = Ogre::Vector2(hit.x, hit.y) - ground;
+      hits = true;
+    }
+    else
+    {
+      offset = { direction.x, direction.y };
+      if (offset.squaredLength() == 0)
+      {
+        continue;
+      }
+      offset *= maxDistance / offset.length();
+    }
+
+    float const distance = offset.length();
+    points.push_back(ground + (distance > maxDistance ? offset * (maxDistance / distance) : offset));
+  }
+
+  if (!hits)
+  {
+    return boost::none;
+  }
+
+  std::vector<Ogre::Vector2> polygon = detail::convexHull(std::move(points));
+  if (polygon.size() < 3)
+  {
+    return boost::none;
+  }
+
+  Ogre::Vector2 const focus = detail::nearestPointInPolygon(polygon, ground);
+  return ViewFootprint{ std::move(polygon), focus };
+}
@@ -12,22 +12,31 @@ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 See the License for the specific language governing permissions and
 limitations under the License. */
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <tuple>
 #include <unordered_map>
 #include <QtGlobal>
 #include <QImage>
 
+#include <diagnostic_msgs/DiagnosticArray.h>
 #include <ros/ros.h>
 #include <tf/transform_listener.h>
 
+#include <OGRE/OgreCamera.h>
 #include <OGRE/OgreManualObject.h>
 #include <OGRE/OgreMaterialManager.h>
 #include <OGRE/OgreSceneManager.h>
 #include <OGRE/OgreSceneNode.h>
 #include <OGRE/OgreTextureManager.h>
 #include <OGRE/OgreImageCodec.h>
+#include <OGRE/OgreTechnique.h>
 
 #include "rviz/frame_manager.h"
 #include "rviz/ogre_helpers/grid.h"
+#include "rviz/properties/enum_property.h"
 #include "rviz/properties/float_property.h"
 #include "rviz/properties/int_property.h"
 #include "rviz/properties/property.h"
@@ -36,10 +45,60 @@ limitations under the License. */
 #include "rviz/properties/vector_property.h"
 #include "rviz/validate_floats.h"
 #include "rviz/display_context.h"
+#include "rviz/view_controller.h"
+#include "rviz/view_manager.h"
 
 #include "aerialmap_display.h"
 #include "General.h"
 
+namespace
+{
+/**
+ * The region of the texture of @p ancestor that covers @p tileId, in texture coordinates
+ *
+ * As expected by TileMesh::setQuad(), v = 0 is the southern border of the ancestor.
+ */
+AtlasRect ancestorRegion(TileId const& ancestor, TileId const& tileId)
+{
+  int const levels = tileId.zoom - ancestor.zoom;
+  float const scale = 1 << levels;
+  // position of tileId inside the ancestor, in tiles
+  int const offset_x = tileId.coord.x - (ancestor.coord.x << levels);
+  int const offset_y = tileId.coord.y - (ancestor.coord.y << levels);
+
+  return { offset_x / scale, 1 - (offset_y + 1) / scale, (offset_x + 1) / scale, 1 - offset_y / scale };
+}
+
+/**
+ * Is the tile at @p coord of the level @p level covered by the next finer level, whose area is `areas[level - 1]`?
+ *
+ * @see rviz::AerialMapDisplay::levelAreas()
+ */
+bool coveredByFinerLevel(std::vector<Area> const& areas, std::size_t level, TileCoordinate const& coord)
+{
+  if (level == 0)
+  {
+    return false;
+  }
+
+  Area const& finer = areas[level - 1];
+  return coord.x >= finer.leftTop.x >> 1 && coord.x <= finer.rightBottom.x >> 1 && coord.y >= finer.leftTop.y >> 1 &&
+         coord.y <= finer.rightBottom.y >> 1;
+}
+
+/**
+ * The median, the 90th percentile and the max. of @p histogram, see detail::LatencyHistogram::quantileMs()
+ */
+QString formatLatency(detail::LatencyHistogram const& histogram)
+{
+  return QString("p50 %1 ms, p90 %2 ms, max %3 ms (%4 tiles)")
+      .arg(histogram.quantileMs(0.5), 0, 'f', 0)
+      .arg(histogram.quantileMs(0.9), 0, 'f', 0)
+      .arg(histogram.maxMs(), 0, 'f', 0)
+      .arg(histogram.count());
+}
+}  // namespace
+
 namespace rviz
 {
 /**
@@ -47,10 +106,12 @@ namespace rviz
  * The sequence of events is rather complex due to the asynchronous nature of the tile texture updates, and the
  * different coordinate systems and frame transforms involved:
  *
- * The navSatFixCallback calls the updateCenterTile function, which then queries a texture update and calls
- * transformTileToMapFrame. The latter finds and stores the transform from the NavSatFix frame to the map-frame, to
- * which the tiles are rigidly attached by ENU convention and Mercator projection. On each frame, update() is called,
- * which calls transformMapTileToFixedFrame, which then transforms the tile-map from the map-frame to the fixed-frame.
+ * The navSatFixCallback runs on its own thread. It only stores the latest message and checks whether it left the
+ * center tile. On each frame, update() is called, which calls processPendingFix with the latest message. If the
+ * message may have left the center tile, processPendingFix calls the updateCenterTile function, which then queries a
+ * texture update. Either way, it calls transformTileToMapFrame, which finds and stores the transform from the NavSatFix
+ * frame to the map-frame, to which the tiles are rigidly attached by ENU convention and Mercator projection. Then
+ * update() calls transformMapTileToFixedFrame, which transforms the tile-map from the map-frame to the fixed-frame.
  * Splitting this transform lookup is necessary to mitigate frame jitter.
  */
 
@@ -80,21 +141,144 @@ AerialMapDisplay::AerialMapDisplay() : Display(), dirty_(false)
   tile_url_property_ =
       new StringProperty("Object URI", "", "URL from which to retrieve map tiles.", this, SLOT(updateTileUrl()));
   tile_url_property_->setShouldBeSaved(true);
-  tile_url_ = tile_url_property_->getStdString();
+  tile_server_ = TileServer(tile_url_property_->getStdString());
+
+  max_requests_property_ =
+      new IntProperty("Max Requests", 6,
+                      "Max. number of parallel requests to the tile server. Qt opens at most 6 connections per host, "
+                      "so more requests only pay off with HTTP/2 or subdomains ({s} in the Object URI).",
+                      this, SLOT(updateTileServerSettings()));
+  max_requests_property_->setShouldBeSaved(true);
+  max_requests_property_->setMin(1);
+  max_requests_property_->setMax(64);
+
+  http2_property_ = new Property("HTTP/2", false, "Allow HTTP/2, which multiplexes all requests over one connection.",
+                                 this, SLOT(updateTileServerSettings()));
+  http2_property_->setShouldBeSaved(true);
+
+  tile_size_property_ = new EnumProperty("Tile Size", QString::number(tileSizePx),
+                                         "Width/ height of the tiles of the tile server in pixels. Bigger tiles have "
+                                         "the resolution of a higher zoom level, so fewer tiles are requested.",
+                                         this, SLOT(updateTileSize()));
+  for (int tile_size = tileSizePx; tile_size <= maxTileSizePx; tile_size *= 2)
+  {
+    tile_size_property_->addOption(QString::number(tile_size), tile_size);
+  }
+  tile_size_property_->setShouldBeSaved(true);
+  tile_size_ = tile_size_property_->getOptionInt();
+  updateTileServerSettings();
 
-  QString const zoom_desc = QString::fromStdString("Zoom level (0 - " + std::to_string(maxZoom) + ")");
+  QString const zoom_desc = QString::fromStdString("Zoom level (0 - " + std::to_string(maxZoom) +
+                                                   ") of the resolution of the map, as if its tiles had " +
+                                                   std::to_string(tileSizePx) + " pixels");
   zoom_property_ = new IntProperty("Zoom", 16, zoom_desc, this, SLOT(updateZoom()));
   zoom_property_->setShouldBeSaved(true);
   zoom_property_->setMin(0);
   zoom_property_->setMax(maxZoom);
   zoom_ = zoom_property_->getInt();
 
-  QString const blocks_desc = QString::fromStdString("Adjacent blocks (0 - " + std::to_string(maxBlocks) + ")");
+  QString const blocks_desc = QString::fromStdString(
+      "Adjacent blocks (0 - " + std::to_string(maxBlocks) + ") of 256 pixel tiles, fewer bigger tiles cover as much.");
   blocks_property_ = new IntProperty("Blocks", 3, blocks_desc, this, SLOT(updateBlocks()));
   blocks_property_->setShouldBeSaved(true);
   blocks_property_->setMin(0);
   blocks_property_->setMax(maxBlocks);
   blocks_ = blocks_property_->getInt();
+
+  upload_tiles_property_ =
+      new IntProperty("Uploads Per Frame", 8, "Max. number of tiles uploaded to the GPU per frame (0 = unlimited).",
+                      this, SLOT(updateUploadBudget()));
+  upload_tiles_property_->setShouldBeSaved(true);
+  upload_tiles_property_->setMin(0);
+  upload_tiles_ = upload_tiles_property_->getInt();
+
+  upload_time_property_ = new FloatProperty("Upload Budget", 4, "Max. time in ms spent uploading tiles per frame.",
+                                            this, SLOT(updateUploadBudget()));
+  upload_time_property_->setShouldBeSaved(true);
+  upload_time_property_->setMin(0);
+  upload_time_ = upload_time_property_->getFloat();
+
+  cache_size_property_ =
+      new IntProperty("Cache Size", 256, "Max. memory in MB used for keeping loaded tiles in memory.", this,
+                      SLOT(updateCacheSize()));
+  cache_size_property_->setShouldBeSaved(true);
+  cache_size_property_->setMin(0);
+  updateCacheSize();
+
+  disk_cache_size_property_ =
+      new IntProperty("Disk Cache Size", 2048, "Max. disk space in MB used for caching downloaded tiles.", this,
+                      SLOT(updateDiskCache()));
+  disk_cache_size_property_->setShouldBeSaved(true);
+  disk_cache_size_property_->setMin(0);
+
+  disk_cache_age_property_ =
+      new IntProperty("Disk Cache Expiry", 0, "Reload cached tiles after this many days (0 = never).", this,
+                      SLOT(updateDiskCache()));
+  disk_cache_age_property_->setShouldBeSaved(true);
+  disk_cache_age_property_->setMin(0);
+  updateDiskCache();
+
+  prefetch_property_ = new FloatProperty("Prefetch Time", 0,
+                                         "Load the tiles ahead of the robot that it will reach within this many "
+                                         "seconds, based on its estimated velocity (0 = disabled).",
+                                         this, SLOT(updatePrefetch()));
+  prefetch_property_->setShouldBeSaved(true);
+  prefetch_property_->setMin(0);
+  prefetch_time_ = prefetch_property_->getFloat();
+
+  fallback_levels_property_ =
+      new IntProperty("Fallback Levels", 3,
+                      "Until a tile is loaded, show the part of a tile up to this many zoom levels above which covers "
+                      "it (0 = disabled).",
+                      this, SLOT(updateFallbackLevels()));
+  fallback_levels_property_->setShouldBeSaved(true);
+  fallback_levels_property_->setMin(0);
+  fallback_levels_property_->setMax(maxZoom);
+  fallback_levels_ = fallback_levels_property_->getInt();
+
+  QString const lod_levels_desc = QString::fromStdString(
+      "Show rings of tiles of this many lower zoom levels around the configured zoom level, each reaching twice as "
+      "far as the one inside it (0 - " +
+      std::to_string(maxLodLevels) + ", 0 = disabled)");
+  lod_levels_property_ = new IntProperty("LOD Levels", 0, lod_levels_desc, this, SLOT(updateLodLevels()));
+  lod_levels_property_->setShouldBeSaved(true);
+  lod_levels_property_->setMin(0);
+  lod_levels_property_->setMax(maxLodLevels);
+  lod_levels_ = lod_levels_property_->getInt();
+
+  view_frustum_property_ = new Property("Follow View", false,
+                                        "Only load the tiles that the camera sees, with the finest tiles where the "
+                                        "map is nearest to the camera.",
+                                        this, SLOT(updateViewFrustum()));
+  view_frustum_property_->setShouldBeSaved(true);
+  view_frustum_ = view_frustum_property_->getValue().toBool();
+
+  mipmaps_property_ = new Property("Mipmaps", false,
+                                   "Use mipmaps, which reduces aliasing of distant tiles but needs about half again "
+                                   "as much texture memory.",
+                                   this, SLOT(updateMipmaps()));
+  mipmaps_property_->setShouldBeSaved(true);
+  mipmaps_ = mipmaps_property_->getValue().toBool();
+
+  terrain_url_property_ =
+      new StringProperty("Terrain URI", "",
+                         "URL from which to retrieve DEM tiles to drape the map on the terrain (empty = flat map).",
+                         this, SLOT(updateTerrain()));
+  terrain_url_property_->setShouldBeSaved(true);
+  terrain_server_ = TileServer(terrain_url_property_->getStdString());
+
+  terrain_encoding_property_ = new EnumProperty("Terrain Encoding", "Terrarium",
+                                                "How the DEM tiles encode the elevation in their pixels.", this,
+                                                SLOT(updateTerrain()));
+  terrain_encoding_property_->addOption("Terrarium", static_cast<int>(TerrainEncoding::Terrarium));
+  terrain_encoding_property_->addOption("Mapbox Terrain-RGB", static_cast<int>(TerrainEncoding::MapboxTerrainRgb));
+  terrain_encoding_property_->setShouldBeSaved(true);
+  terrain_encoding_ = static_cast<TerrainEncoding>(terrain_encoding_property_->getOptionInt());
+
+  diagnostics_property_ = new Property("Publish Diagnostics", false,
+                                       "Publish the latencies of loading and drawing the tiles on /diagnostics.", this,
+                                       SLOT(updateDiagnostics()));
+  diagnostics_property_->setShouldBeSaved(true);
 }
 
 AerialMapDisplay::~AerialMapDisplay()
@@ -127,7 +311,15 @@ void AerialMapDisplay::subscribe()
     try
     {
       ROS_INFO("Subscribing to %s", topic_property_->getTopicStd().c_str());
-      coord_sub_ = update_nh_.subscribe(topic_property_->getTopicStd(), 1, &AerialMapDisplay::navFixCallback, this);
+      // receive the messages on their own thread, so that high-rate fixes don't stall the render thread
+      ros::NodeHandle fix_nh(update_nh_);
+      fix_nh.setCallbackQueue(&fix_queue_);
+      coord_sub_ = fix_nh.subscribe(topic_property_->getTopicStd(), 1, &AerialMapDisplay::navFixCallback, this);
+      if (!fix_spinner_)
+      {
+        fix_spinner_.reset(new ros::AsyncSpinner(1, &fix_queue_));
+        fix_spinner_->start();
+      }
 
       setStatus(StatusProperty::Ok, "Topic", "OK");
     }
@@ -145,9 +337,10 @@ void AerialMapDisplay::unsubscribe()
 
 void AerialMapDisplay::updateAlpha()
 {
-  // if draw_under_ texture property changed, we need to
-  //  - repaint textures
+  // if the alpha property changed, we need to
+  //  - update the materials
   // we don't need to
+  //  - repaint textures
   //  - query textures
   //  - re-create tile grid geometry
   //  - update the center tile
@@ -166,14 +359,15 @@ void AerialMapDisplay::updateAlpha()
     return;
   }
 
-  dirty_ = true;
+  material_dirty_ = true;
 }
 
 void AerialMapDisplay::updateDrawUnder()
 {
   // if draw_under_ texture property changed, we need to
-  //  - repaint textures
+  //  - update the materials
   // we don't need to
+  //  - repaint textures
   //  - query textures
   //  - re-create tile grid geometry
   //  - update the center tile
@@ -192,7 +386,7 @@ void AerialMapDisplay::updateDrawUnder()
     return;
   }
 
-  dirty_ = true;
+  material_dirty_ = true;
 }
 
 void AerialMapDisplay::updateTileUrl()
@@ -205,13 +399,14 @@ void AerialMapDisplay::updateTileUrl()
   //  - update the center tile
   //  - update transforms
 
-  auto const tile_url = tile_url_property_->getStdString();
-  if (tile_url == tile_url_)
+  TileServer const tile_server(tile_url_property_->getStdString());
+  if (tile_server == tile_server_)
   {
     return;
   }
 
-  tile_url_ = tile_url;
+  tile_server_ = tile_server;
+  updateTileServerSettings();
 
   if (!isEnabled())
   {
@@ -251,6 +446,38 @@ void AerialMapDisplay::updateZoom()
   }
 }
 
+void AerialMapDisplay::updateTileSize()
+{
+  // if the tile size changed, we need to
+  //  - re-create tile grid geometry
+  //  - update the center tile, since the tiles of another zoom level are shown
+  //  - query textures
+  //  - repaint textures
+  //  - update transforms
+
+  auto const tile_size = tile_size_property_->getOptionInt();
+  if (tile_size == tile_size_)
+  {
+    return;
+  }
+
+  tile_size_ = tile_size;
+  updateTileServerSettings();
+
+  if (!isEnabled())
+  {
+    return;
+  }
+
+  createTileObjects();
+
+  // updateCenterTile() requests the tiles if the center tile changed
+  if (!ref_fix_ || !updateCenterTile(ref_fix_))
+  {
+    requestTileTextures();
+  }
+}
+
 void AerialMapDisplay::updateBlocks()
 {
   // if the number of blocks changed, we need to
@@ -278,6 +505,227 @@ void AerialMapDisplay::updateBlocks()
   requestTileTextures();
 }
 
+void AerialMapDisplay::updateUploadBudget()
+{
+  // the upload budget is read on every frame, so we don't need to update anything else
+  upload_tiles_ = upload_tiles_property_->getInt();
+  upload_time_ = upload_time_property_->getFloat();
+}
+
+void AerialMapDisplay::updateCacheSize()
+{
+  // tiles are kept in the cache as long it doesn't exceed this limit, so we don't need to update anything else
+  std::size_t constexpr mega_byte = 1024 * 1024;
+  tileCache_.setMaxBytes(static_cast<std::size_t>(cache_size_property_->getInt()) * mega_byte);
+  terrain_cache_.setMaxBytes(static_cast<std::size_t>(cache_size_property_->getInt()) * mega_byte);
+}
+
+void AerialMapDisplay::updateDiskCache()
+{
+  // the disk cache is evicted in the background, so we don't need to update anything else
+  qint64 constexpr mega_byte = 1024 * 1024;
+  qint64 constexpr day = 24 * 60 * 60;
+  tileCache_.setDiskCacheLimits(disk_cache_size_property_->getInt() * mega_byte,
+                                disk_cache_age_property_->getInt() * day);
+}
+
+void AerialMapDisplay::updateTileServerSettings()
+{
+  // the settings apply to the next requests, so we don't need to update anything else
+  detail::TileServerSettings settings;
+  settings.maxRequests = static_cast<std::size_t>(max_requests_property_->getInt());
+  settings.http2 = http2_property_->getValue().toBool();
+  settings.tileSizePx = tile_size_;
+  tileCache_.setTileServerSettings(tile_server_, settings);
+  // DEM tiles are always sampled at the size they are served with
+  settings.tileSizePx = tileSizePx;
+  if (!terrain_server_.empty())
+  {
+    terrain_cache_.setTileServerSettings(terrain_server_, settings);
+  }
+}
+
+void AerialMapDisplay::updatePrefetch()
+{
+  // if the prefetch time changed, we need to
+  //  - query textures
+  // we don't need to
+  //  - repaint textures
+  //  - re-create tile grid geometry
+  //  - update the center tile
+  //  - update transforms
+
+  auto const prefetch_time = prefetch_property_->getFloat();
+  if (prefetch_time == prefetch_time_)
+  {
+    return;
+  }
+
+  prefetch_time_ = prefetch_time;
+
+  if (!isEnabled() || !lastCenterTile_)
+  {
+    return;
+  }
+
+  requestTileTextures();
+}
+
+void AerialMapDisplay::updateFallbackLevels()
+{
+  // if the fallback levels changed, we need to
+  //  - query textures
+  //  - repaint textures
+  // we don't need to
+  //  - re-create tile grid geometry
+  //  - update the center tile
+  //  - update transforms
+
+  auto const fallback_levels = fallback_levels_property_->getInt();
+  if (fallback_levels == fallback_levels_)
+  {
+    return;
+  }
+
+  fallback_levels_ = fallback_levels;
+
+  if (!isEnabled() || !lastCenterTile_)
+  {
+    return;
+  }
+
+  requestTileTextures();
+}
+
+void AerialMapDisplay::updateLodLevels()
+{
+  // if the number of LOD levels changed, we need to
+  //  - re-create tile grid geometry
+  //  - query textures
+  //  - repaint textures
+  // we don't need to
+  //  - update the center tile
+  //  - update transforms
+
+  auto const lod_levels = lod_levels_property_->getInt();
+  if (lod_levels == lod_levels_)
+  {
+    return;
+  }
+
+  lod_levels_ = lod_levels;
+
+  if (!isEnabled())
+  {
+    return;
+  }
+
+  createTileObjects();
+  requestTileTextures();
+}
+
+void AerialMapDisplay::updateTerrain()
+{
+  // if the terrain changed, we need to
+  //  - re-create tile grid geometry, if the terrain was switched on or off
+  //  - query textures
+  //  - re-assemble all tiles
+  // we don't need to
+  //  - update the center tile
+  //  - update transforms
+
+  TileServer const terrain_server(terrain_url_property_->getStdString());
+  auto const encoding = static_cast<TerrainEncoding>(terrain_encoding_property_->getOptionInt());
+  if (terrain_server == terrain_server_ && encoding == terrain_encoding_)
+  {
+    return;
+  }
+
+  bool const toggled = terrain_server.empty() != terrain_server_.empty();
+  terrain_server_ = terrain_server;
+  terrain_encoding_ = encoding;
+  terrain_reference_ = boost::none;
+  updateTileServerSettings();
+
+  if (!isEnabled())
+  {
+    return;
+  }
+
+  if (toggled)
+  {
+    createTileObjects();
+  }
+  else
+  {
+    layout_dirty_ = true;
+  }
+  requestTileTextures();
+}
+
+void AerialMapDisplay::updateViewFrustum()
+{
+  // if the view mode changed, we need to
+  //  - query textures
+  //  - re-assemble all tiles, since the areas change
+  // we don't need to
+  //  - re-create tile grid geometry
+  //  - update the center tile
+  //  - update transforms
+
+  view_frustum_ = view_frustum_property_->getValue().toBool();
+  view_footprint_ = boost::none;
+  view_areas_.clear();
+
+  if (!isEnabled())
+  {
+    return;
+  }
+
+  layout_dirty_ = true;
+  requestTileTextures();
+}
+
+void AerialMapDisplay::updateDiagnostics()
+{
+  // the diagnostics don't affect the tiles, they are only published by updatePipelineStatus()
+  if (diagnostics_property_->getValue().toBool())
+  {
+    diagnostics_pub_ = update_nh_.advertise<diagnostic_msgs::DiagnosticArray>("/diagnostics", 1);
+  }
+  else
+  {
+    diagnostics_pub_.shutdown();
+  }
+}
+
+void AerialMapDisplay::updateMipmaps()
+{
+  // if mipmaps are enabled or disabled, we need to
+  //  - re-create the atlas textures and tile grid geometry
+  //  - query textures
+  //  - repaint textures
+  // we don't need to
+  //  - update the center tile
+  //  - update transforms
+
+  auto const mipmaps = mipmaps_property_->getValue().toBool();
+  if (mipmaps == mipmaps_)
+  {
+    return;
+  }
+
+  mipmaps_ = mipmaps;
+
+  if (!isEnabled())
+  {
+    return;
+  }
+
+  createTileObjects();
+  requestTileTextures();
+}
+
 void AerialMapDisplay::updateTopic()
 {
   // if the NavSat topic changes, we reset everything
@@ -295,8 +743,15 @@ void AerialMapDisplay::updateTopic()
 
 void AerialMapDisplay::clearAll()
 {
+  {
+    std::lock_guard<std::mutex> guard(fix_mutex_);
+    pending_fix_ = nullptr;
+    pending_transition_ = false;
+    center_bounds_ = boost::none;
+  }
   ref_fix_ = nullptr;
   lastCenterTile_ = boost::none;
+  velocity_.reset();
   destroyTileObjects();
 
   setStatus(StatusProperty::Warn, "Message", "No map received yet");
@@ -304,104 +759,168 @@ void AerialMapDisplay::clearAll()
 
 void AerialMapDisplay::destroyTileObjects()
 {
-  for (MapObject& obj : objects_)
+  for (Level& level : levels_)
   {
-    // destroy object
-    scene_node_->detachObject(obj.object);
-    scene_manager_->destroyManualObject(obj.object);
-
-    // destroy material
-    if (!obj.material.isNull())
-    {
-      Ogre::MaterialManager::getSingleton().remove(obj.material->getName());
-    }
+    // destroy the mesh before the materials it uses
+    level.mesh.reset();
+    level.atlas.reset();
   }
-  objects_.clear();
+  levels_.clear();
 }
 
 void AerialMapDisplay::createTileObjects()
 {
-  if (not objects_.empty())
+  if (!levels_.empty())
   {
     destroyTileObjects();
   }
 
-  for (int block = 0; block < (2 * blocks_ + 1) * (2 * blocks_ + 1); ++block)
-  {
-    // generate an unique name
-    static int count = 0;
-    std::string const name_suffix = std::to_string(count);
-    ++count;
-
-    // one material per texture
-    Ogre::MaterialPtr material = Ogre::MaterialManager::getSingleton().create(
-        "satellite_material_" + name_suffix, Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME);
-    material->setReceiveShadows(false);
-    material->getTechnique(0)->setLightingEnabled(false);
-    material->setDepthBias(-16.0f, 0.0f);
-    material->setCullingMode(Ogre::CULL_NONE);
-    material->setDepthWriteEnabled(false);
+  // the areas of the finer levels are extended by up to one tile, see levelAreas()
+  int const lod_levels = lodLevels();
+  grid_size_ = 2 * tileBlocks() + 1 + (lod_levels > 0 ? 1 : 0);
 
-    // create texture and initialize it
-    Ogre::TextureUnitState* tex_unit = material->getTechnique(0)->getPass(0)->createTextureUnitState();
-    tex_unit->setTextureFiltering(Ogre::TFO_BILINEAR);
-
-    // create an object
-    Ogre::ManualObject* obj = scene_manager_->createManualObject("satellite_object_" + name_suffix);
-    obj->setVisible(false);
-    scene_node_->attachObject(obj);
-
-    assert(!material.isNull());
-    objects_.emplace_back(obj, material);
+  std::size_t const cellCount = grid_size_ * grid_size_;
+  levels_.resize(lod_levels + 1);
+  for (Level& level : levels_)
+  {
+    level.atlas.reset(new TileAtlas(page_pool_, tile_size_, cellCount, mipmaps_));
+    level.mesh.reset(new TileMesh(scene_manager_, scene_node_, *level.atlas,
+                                  terrain_server_.empty() ? 1 : terrainSegments));
+    level.cells.assign(cellCount, Cell());
+    level.min_z = 0;
+    level.max_z = 0;
   }
+
+  layout_dirty_ = true;
+  material_dirty_ = true;
 }
 
 void AerialMapDisplay::update(float, float)
 {
+  processPendingFix();
+
   if (not ref_fix_ or not lastCenterTile_)
   {
     return;
   }
 
   // update tiles, if necessary
+  updateViewFootprint();
   assembleScene();
+  updateCacheStatus();
+  updatePipelineStatus();
   // transform scene object into fixed frame
   transformMapTileToFixedFrame();
 }
 
 void AerialMapDisplay::navFixCallback(sensor_msgs::NavSatFixConstPtr const& msg)
 {
-  // TODO: even if the center tile does not change, our lat/lon and tf relationship could have been changed? so update
-  // the transform either way?
-  updateCenterTile(msg);
+  // This runs on the thread of fix_queue_ for every message, so only check the cheap bounds of the center tile. The
+  // message is processed on the next frame, see processPendingFix().
+  std::lock_guard<std::mutex> guard(fix_mutex_);
+  pending_fix_ = msg;
+  if (!center_bounds_ || !center_bounds_->contains({ msg->latitude, msg->longitude }))
+  {
+    pending_transition_ = true;
+  }
+}
+
+void AerialMapDisplay::processPendingFix()
+{
+  sensor_msgs::NavSatFixConstPtr msg;
+  bool transition = false;
+  {
+    std::lock_guard<std::mutex> guard(fix_mutex_);
+    msg.swap(pending_fix_);
+    std::swap(transition, pending_transition_);
+  }
+
+  if (!msg)
+  {
+    return;
+  }
+
+  if (!std::isfinite(msg->latitude) || !std::isfinite(msg->longitude))
+  {
+    setStatus(StatusProperty::Error, "Message", "NavSatFix has an invalid position");
+    return;
+  }
+
+  // fall back to the receive time if the GPS driver doesn't stamp its messages
+  double const stamp = msg->header.stamp.isZero() ? ros::Time::now().toSec() : msg->header.stamp.toSec();
+  velocity_.update({ msg->latitude, msg->longitude }, stamp);
+
+  try
+  {
+    // the transform is updated with every message, since the relationship between lat/lon and tf changes even if the
+    // center tile doesn't
+    bool const moved = transition && updateCenterTile(msg);
+    if (!moved && lastCenterTile_)
+    {
+      transformTileToMapFrame(msg);
+    }
+  }
+  catch (std::invalid_argument const& e)
+  {
+    setStatus(StatusProperty::Error, "Message", QString("Invalid NavSatFix: ") + e.what());
+    return;
+  }
 
   setStatus(StatusProperty::Ok, "Message", "NavSatFix okay");
 }
 
-void AerialMapDisplay::updateCenterTile(sensor_msgs::NavSatFixConstPtr const& msg)
+bool AerialMapDisplay::updateCenterTile(sensor_msgs::NavSatFixConstPtr const& msg)
 {
   if (!isEnabled())
   {
-    return;
+    return false;
   }
 
   // check if update is necessary
-  auto const tileCoordinates = fromWGSCoordinate({ msg->latitude, msg->longitude }, zoom_);
-  TileId const newCenterTileID{ tile_url_, tileCoordinates, zoom_ };
+  int const tile_zoom = tileZoom();
+  auto const tileCoordinates = fromWGSCoordinate({ msg->latitude, msg->longitude }, tile_zoom);
+  TileId const newCenterTileID{ tile_server_, tileCoordinates, tile_zoom };
   bool const centerTileChanged = (!lastCenterTile_ || !(newCenterTileID == *lastCenterTile_));
 
+  {
+    // the messages inside these bounds don't need to be checked again, see navFixCallback()
+    std::lock_guard<std::mutex> guard(fix_mutex_);
+    center_bounds_ = tileBounds(tileCoordinates, tile_zoom);
+  }
+
   if (not centerTileChanged)
   {
-    return;
+    return false;
   }
 
   ROS_DEBUG_NAMED("rviz_satellite", "Updating center tile");
 
+  // the footprint of the view is given relative to the center tile, see updateViewFootprint()
+  if (view_footprint_ && lastCenterTile_ && lastCenterTile_->zoom == tile_zoom)
+  {
+    double const tile_w_h_m = getTileWH(msg->latitude, tile_zoom);
+    Ogre::Vector2 const shift(static_cast<float>((lastCenterTile_->coord.x - tileCoordinates.x) * tile_w_h_m),
+                              static_cast<float>((tileCoordinates.y - lastCenterTile_->coord.y) * tile_w_h_m));
+    for (Ogre::Vector2& point : view_footprint_->polygon)
+    {
+      point += shift;
+    }
+    view_footprint_->focus += shift;
+  }
+  else
+  {
+    view_footprint_ = boost::none;
+  }
+
   lastCenterTile_ = newCenterTileID;
   ref_fix_ = msg;
+  layout_dirty_ = true;
+  // the terrain is placed relative to the new reference position
+  terrain_reference_ = boost::none;
 
   requestTileTextures();
-  transformTileToMapFrame();
+  transformTileToMapFrame(msg);
+  return true;
 }
 
 void AerialMapDisplay::requestTileTextures()
@@ -411,7 +930,7 @@ void AerialMapDisplay::requestTileTextures()
     return;
   }
 
-  if (tile_url_.empty())
+  if (tile_server_.empty())
   {
     setStatus(StatusProperty::Error, "TileRequest", "Tile URL is not set");
     return;
@@ -425,7 +944,20 @@ void AerialMapDisplay::requestTileTextures()
 
   try
   {
-    tileCache_.request({ *lastCenterTile_, blocks_ });
+    // tiles along the predicted path are loaded after the visible ones
+    std::vector<TileId> prefetch;
+    if (prefetch_time_ > 0 && ref_fix_ && velocity_.velocity())
+    {
+      prefetch = predictTiles(*lastCenterTile_, tileBlocks(), { ref_fix_->latitude, ref_fix_->longitude },
+                              *velocity_.velocity(), prefetch_time_);
+    }
+
+    std::vector<Area> const areas = levelAreas();
+    tileCache_.request(areas, prefetch, fallback_levels_);
+    if (!terrain_server_.empty())
+    {
+      terrain_cache_.request(terrainAreas(areas), {}, fallback_levels_);
+    }
     dirty_ = true;
   }
   catch (std::exception const& e)
@@ -438,8 +970,12 @@ void AerialMapDisplay::requestTileTextures()
 void AerialMapDisplay::checkRequestErrorRate()
 {
   // the following error rate thresholds are randomly chosen
-  float const errorRate = tileCache_.getTileServerErrorRate(tile_url_);
-  if (errorRate > 0.95)
+  float const errorRate = tileCache_.getTileServerErrorRate(tile_server_);
+  if (tileCache_.isTileServerThrottled(tile_server_))
+  {
+    setStatus(StatusProperty::Level::Warn, "TileRequest", "The tile server asked to pause the requests");
+  }
+  else if (errorRate > 0.95)
   {
     setStatus(StatusProperty::Level::Error, "TileRequest", "Few or no tiles received");
   }
@@ -454,55 +990,316 @@ void AerialMapDisplay::checkRequestErrorRate()
   }
 }
 
-void AerialMapDisplay::assembleScene()
+int AerialMapDisplay::tileZoom() const
+{
+  return std::max(0, zoom_ - tileZoomOffset(tile_size_));
+}
+
+int AerialMapDisplay::tileBlocks() const
+{
+  return scaleBlocks(blocks_, tile_size_);
+}
+
+int AerialMapDisplay::lodLevels() const
+{
+  // there are no tiles above zoom level 0
+  return std::min(lod_levels_, tileZoom());
+}
+
+std::vector<Area> AerialMapDisplay::levelAreas() const
 {
-  if (!isEnabled() || !dirty_ || !lastCenterTile_)
+  std::vector<Area> areas;
+  int const lod_levels = lodLevels();
+  bool const follow_view = view_frustum_ && view_footprint_;
+  double const tile_w_h_m = follow_view ? getTileWH(ref_fix_->latitude, tileZoom()) : 0;
+  TileId const focus = follow_view ? viewFocusTile(tile_w_h_m) : *lastCenterTile_;
+  for (int level = 0; level <= lod_levels; ++level)
+  {
+    Area area(ancestorOf(focus, level), tileBlocks());
+    if (follow_view)
+    {
+      area = clipToView(area, level, tile_w_h_m);
+    }
+    areas.push_back(level < lod_levels ? alignToParent(area) : area);
+  }
+  return areas;
+}
+
+void AerialMapDisplay::updateViewFootprint()
+{
+  if (!view_frustum_)
   {
     return;
   }
 
-  if (objects_.empty())
+  ViewController* view = context_->getViewManager()->getCurrent();
+  Ogre::Camera* camera = view ? view->getCamera() : nullptr;
+  if (!camera)
   {
-    ROS_ERROR_THROTTLE_NAMED(5, "rviz_satellite", "No objects to draw on, call createTileObjects() first!");
     return;
   }
 
-  dirty_ = false;
+  // the rays through the corners of the viewport in the frame of the tiles, see assembleLevel()
+  Ogre::Quaternion const to_local = scene_node_->_getDerivedOrientation().Inverse();
+  std::vector<Ogre::Ray> rays;
+  for (Ogre::Vector2 const& corner : { Ogre::Vector2(0, 0), Ogre::Vector2(1, 0), Ogre::Vector2(1, 1),
+                                       Ogre::Vector2(0, 1) })
+  {
+    Ogre::Ray const ray = camera->getCameraToViewportRay(corner.x, corner.y);
+    rays.emplace_back(scene_node_->convertWorldToLocalPosition(ray.getOrigin()), to_local * ray.getDirection());
+  }
 
-  Area area(*lastCenterTile_, blocks_);
+  // nothing is shown beyond the area of the coarsest level
+  double const tile_w_h_m = getTileWH(ref_fix_->latitude, tileZoom());
+  auto const max_distance = static_cast<float>((2 * tileBlocks() + 2) * (1 << lodLevels()) * tile_w_h_m);
 
-  TileCacheGuard guard(tileCache_);
+  // keep the tiles if the camera looks away from the map
+  boost::optional<ViewFootprint> footprint = viewFootprint(rays, max_distance);
+  if (!footprint)
+  {
+    return;
+  }
+  view_footprint_ = std::move(footprint);
 
-  bool loadedAllTiles = true;
+  // only request the tiles again if the view moved to other tiles
+  std::vector<Area> const areas = levelAreas();
+  if (areas != view_areas_)
+  {
+    view_areas_ = areas;
+    layout_dirty_ = true;
+    requestTileTextures();
+  }
+}
 
-  auto it = objects_.begin();
-  for (int xx = area.leftTop.x; xx <= area.rightBottom.x; ++xx)
+TileId AerialMapDisplay::viewFocusTile(double tile_w_h_m) const
+{
+  // invert the placement of the tiles in assembleLevel()
+  TileCoordinate const& center = lastCenterTile_->coord;
+  int const max_tile = zoomToMaxTiles(lastCenterTile_->zoom);
+  double const x = std::floor(center.x + view_footprint_->focus.x / tile_w_h_m);
+  double const y = std::floor(center.y + 1 - view_footprint_->focus.y / tile_w_h_m);
+  TileCoordinate const coord{ static_cast<int>(std::min(std::max(x, 0.0), static_cast<double>(max_tile))),
+                              static_cast<int>(std::min(std::max(y, 0.0), static_cast<double>(max_tile))) };
+  return { lastCenterTile_->tileServer, coord, lastCenterTile_->zoom };
+}
+
+Area AerialMapDisplay::clipToView(Area area, int level, double tile_w_h_m) const
+{
+  // the bounding box of the footprint in tiles of the level, see viewFocusTile()
+  TileCoordinate const& center = lastCenterTile_->coord;
+  double const scale = 1 << level;
+  double min_x = std::numeric_limits<double>::max();
+  double min_y = std::numeric_limits<double>::max();
+  double max_x = std::numeric_limits<double>::lowest();
+  double max_y = std::numeric_limits<double>::lowest();
+  for (Ogre::Vector2 const& point : view_footprint_->polygon)
   {
-    for (int yy = area.leftTop.y; yy <= area.rightBottom.y; ++yy)
-    {
-      auto obj = it->object;
-      auto& material = it->material;
-      assert(!material.isNull());
-      ++it;
+    double const x = (center.x + point.x / tile_w_h_m) / scale;
+    double const y = (center.y + 1 - point.y / tile_w_h_m) / scale;
+    min_x = std::min(min_x, x);
+    min_y = std::min(min_y, y);
+    max_x = std::max(max_x, x);
+    max_y = std::max(max_y, y);
+  }
+
+  auto const clamp = [](double value, int low, int high) {
+    return static_cast<int>(std::min(std::max(std::floor(value), static_cast<double>(low)), static_cast<double>(high)));
+  };
+  TileCoordinate const left_top{ clamp(min_x, area.leftTop.x, area.rightBottom.x),
+                                 clamp(min_y, area.leftTop.y, area.rightBottom.y) };
+  TileCoordinate const right_bottom{ clamp(max_x, area.leftTop.x, area.rightBottom.x),
+                                     clamp(max_y, area.leftTop.y, area.rightBottom.y) };
+
+  bool const visible = max_x >= area.leftTop.x && min_x < area.rightBottom.x + 1 && max_y >= area.leftTop.y &&
+                       min_y < area.rightBottom.y + 1;
+  if (visible)
+  {
+    area.leftTop = left_top;
+    area.rightBottom = right_bottom;
+  }
+  else
+  {
+    // keep the tile nearest to the view, so that the area isn't empty
+    area.leftTop = { clamp((min_x + max_x) / 2, area.leftTop.x, area.rightBottom.x),
+                     clamp((min_y + max_y) / 2, area.leftTop.y, area.rightBottom.y) };
+    area.rightBottom = area.leftTop;
+  }
+
+  // the center of an area has to be inside of it, see detail::AreaHistory::fit()
+  area.center.coord = { std::min(std::max(area.center.coord.x, area.leftTop.x), area.rightBottom.x),
+                        std::min(std::max(area.center.coord.y, area.leftTop.y), area.rightBottom.y) };
+  return area;
+}
+
+std::vector<Area> AerialMapDisplay::terrainAreas(std::vector<Area> const& areas) const
+{
+  std::vector<Area> terrain_areas;
+  for (Area const& area : areas)
+  {
+    terrain_areas.push_back(terrainAreaOf(area, terrain_server_));
+  }
+  return terrain_areas;
+}
+
+void AerialMapDisplay::updateTerrainReference()
+{
+  if (!terrain_reference_)
+  {
+    terrain_reference_ = terrainElevationAt({ ref_fix_->latitude, ref_fix_->longitude });
+  }
+}
+
+boost::optional<float> AerialMapDisplay::terrainElevationAt(WGSCoordinate const& coord) const
+{
+  if (terrain_server_.empty())
+  {
+    return boost::none;
+  }
+
+  int const zoom = std::min(tileZoom(), maxTerrainZoom);
+  auto const position = fromWGSCoordinate<double>(coord, zoom);
+  TileId const dem_tile{ terrain_server_,
+                         { static_cast<int>(std::floor(position.x)), static_cast<int>(std::floor(position.y)) },
+                         zoom };
+  std::shared_ptr<TileImage const> const dem = terrain_cache_.ready(dem_tile);
+  if (!dem)
+  {
+    return boost::none;
+  }
+
+  return sampleElevation(dem->image, terrain_encoding_, position.x - std::floor(position.x),
+                         position.y - std::floor(position.y));
+}
+
+std::vector<float> AerialMapDisplay::terrainHeightsOf(TileId const& tileId, bool& exact) const
+{
+  exact = false;
+  if (!terrain_reference_)
+  {
+    return {};
+  }
+
+  TileId const dem_tile = terrainTileOf(tileId, terrain_server_);
+  std::pair<TileId, std::shared_ptr<TileImage const>> dem{ dem_tile, terrain_cache_.ready(dem_tile) };
+  if (!dem.second && fallback_levels_ > 0)
+  {
+    dem = terrain_cache_.nearestAncestor(dem_tile, fallback_levels_);
+  }
+  if (!dem.second)
+  {
+    return {};
+  }
+
+  exact = dem.first == dem_tile;
+  return terrainHeights(dem.second->image, dem.first, tileId, terrainSegments, terrain_encoding_, *terrain_reference_);
+}
 
-      TileId const toFind{ lastCenterTile_->tileServer, { xx, yy }, lastCenterTile_->zoom };
+std::size_t AerialMapDisplay::cellOf(TileCoordinate const& coord) const
+{
+  int const n = grid_size_;
+  int const column = ((coord.x % n) + n) % n;
+  int const row = ((coord.y % n) + n) % n;
+  return column * n + row;
+}
 
-      OgreTile const* tile = tileCache_.ready(toFind);
-      if (!tile)
+void AerialMapDisplay::uploadTiles(std::vector<Area> const& areas)
+{
+  struct Upload
+  {
+    std::size_t level;
+    std::size_t cell;
+    TileId tileId;
+    std::shared_ptr<TileImage const> tile;
+    /// whether the tile is uploaded instead of a tile that isn't ready yet
+    bool fallback;
+    int distance;
+  };
+  std::vector<Upload> uploads;
+
+  for (std::size_t level = 0; level < levels_.size(); ++level)
+  {
+    Area const& area = areas[level];
+    std::vector<Cell> const& cells = levels_[level].cells;
+
+    for (int xx = area.leftTop.x; xx <= area.rightBottom.x; ++xx)
+    {
+      for (int yy = area.leftTop.y; yy <= area.rightBottom.y; ++yy)
       {
-        // don't show tiles with old textures
-        obj->setVisible(false);
-        loadedAllTiles = false;
-        continue;
+        if (coveredByFinerLevel(areas, level, { xx, yy }))
+        {
+          continue;
+        }
+
+        std::size_t const cell = cellOf({ xx, yy });
+        TileId const toFind{ area.center.tileServer, { xx, yy }, area.center.zoom };
+        if (cells[cell].tile && *cells[cell].tile == toFind)
+        {
+          continue;
+        }
+
+        int const distance = distanceToCenter(area, { xx, yy });
+
+        std::shared_ptr<TileImage const> tile = tileCache_.ready(toFind);
+        if (tile)
+        {
+          uploads.push_back({ level, cell, toFind, std::move(tile), false, distance });
+          continue;
+        }
+
+        if (fallback_levels_ > 0)
+        {
+          auto const ancestor = tileCache_.nearestAncestor(toFind, fallback_levels_);
+          if (ancestor.second && !(cells[cell].tile && *cells[cell].tile == ancestor.first))
+          {
+            uploads.push_back({ level, cell, ancestor.first, ancestor.second, true, distance });
+          }
+        }
       }
+    }
+  }
 
-      obj->setVisible(true);
+  // replacements come last, and the coarser levels after the finer ones
+  std::sort(uploads.begin(), uploads.end(), [](Upload const& a, Upload const& b) {
+    return std::tie(a.fallback, a.level, a.distance) < std::tie(b.fallback, b.level, b.distance);
+  });
 
-      // update texture
-      Ogre::TextureUnitState* tex_unit = material->getTechnique(0)->getPass(0)->getTextureUnitState(0);
-      tex_unit->setTextureName(tile->texture->getName());
+  std::size_t const max_tiles =
+      upload_tiles_ > 0 ? static_cast<std::size_t>(upload_tiles_) : std::numeric_limits<std::size_t>::max();
+  auto const max_duration = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+      std::chrono::duration<float, std::milli>(upload_time_));
+  auto const start = std::chrono::steady_clock::now();
 
-      // configure depth & alpha properties
+  // upload at least one tile per frame, so that we make progress even with a tiny budget
+  for (std::size_t i = 0; i < uploads.size() && i < max_tiles; ++i)
+  {
+    auto const now = std::chrono::steady_clock::now();
+    if (i > 0 && now - start >= max_duration)
+    {
+      break;
+    }
+
+    Level& level = levels_[uploads[i].level];
+    Cell& cell = level.cells[uploads[i].cell];
+    level.atlas->upload(uploads[i].cell, uploads[i].tile->image);
+    cell.tile = uploads[i].tileId;
+    // fallback tiles only bridge the wait for the wanted tile, so they aren't part of the latencies
+    cell.uploaded = boost::none;
+    if (!uploads[i].fallback)
+    {
+      upload_latency_.add(now - uploads[i].tile->loadedAt);
+      cell.uploaded = now;
+    }
+  }
+}
+
+void AerialMapDisplay::updateMaterials()
+{
+  for (Level const& level : levels_)
+  {
+    TileAtlas const& atlas = *level.atlas;
+    for (std::size_t page = 0; page < atlas.pageCount(); ++page)
+    {
+      Ogre::MaterialPtr const& material = atlas.material(page);
       if (alpha_ >= 0.9998)
       {
         material->setDepthWriteEnabled(!draw_under_);
@@ -514,88 +1311,318 @@ void AerialMapDisplay::assembleScene()
         material->setDepthWriteEnabled(false);
       }
 
-      if (draw_under_)
+      Ogre::TextureUnitState* tex_unit = material->getTechnique(0)->getPass(0)->getTextureUnitState(0);
+      tex_unit->setAlphaOperation(Ogre::LBX_SOURCE1, Ogre::LBS_MANUAL, Ogre::LBS_CURRENT, alpha_);
+    }
+
+    if (draw_under_)
+    {
+      // render under everything else
+      level.mesh->object()->setRenderQueueGroup(Ogre::RENDER_QUEUE_3);
+    }
+    else
+    {
+      level.mesh->object()->setRenderQueueGroup(Ogre::RENDER_QUEUE_MAIN);
+    }
+  }
+}
+
+void AerialMapDisplay::updateCacheStatus()
+{
+  std::size_t constexpr mega_byte = 1024 * 1024;
+
+  TileCacheStats const stats = tileCache_.stats();
+  if (!cache_stats_ || cache_stats_->tiles != stats.tiles || cache_stats_->bytes != stats.bytes ||
+      cache_stats_->hits != stats.hits || cache_stats_->misses != stats.misses)
+  {
+    cache_stats_ = stats;
+    setStatus(StatusProperty::Ok, "Cache",
+              QString("%1 tiles (%2 MB), %3 hits, %4 misses")
+                  .arg(stats.tiles)
+                  .arg(stats.bytes / mega_byte)
+                  .arg(stats.hits)
+                  .arg(stats.misses));
+  }
+
+  // the disk cache statistics only change after an eviction
+  auto const disk_stats = tileCache_.diskCacheStats();
+  if (disk_stats && (!disk_cache_stats_ || disk_cache_stats_->tiles != disk_stats->tiles ||
+                     disk_cache_stats_->bytes != disk_stats->bytes))
+  {
+    disk_cache_stats_ = disk_stats;
+    setStatus(StatusProperty::Ok, "Disk Cache",
+              QString("%1 tiles (%2 of %3 MB)")
+                  .arg(disk_stats->tiles)
+                  .arg(disk_stats->bytes / mega_byte)
+                  .arg(disk_cache_size_property_->getInt()));
+  }
+
+  AtlasPagePoolStats const pool_stats = page_pool_.stats();
+  if (!page_pool_stats_ || page_pool_stats_->used != pool_stats.used ||
+      page_pool_stats_->usedHighWatermark != pool_stats.usedHighWatermark ||
+      page_pool_stats_->free != pool_stats.free || page_pool_stats_->created != pool_stats.created ||
+      page_pool_stats_->reused != pool_stats.reused)
+  {
+    page_pool_stats_ = pool_stats;
+    setStatus(StatusProperty::Ok, "Textures",
+              QString("%1 pages in use (max. %2), %3 free, %4 MB, %5 created, %6 reused")
+                  .arg(pool_stats.used)
+                  .arg(pool_stats.usedHighWatermark)
+                  .arg(pool_stats.free)
+                  .arg(pool_stats.bytes / mega_byte)
+                  .arg(pool_stats.created)
+                  .arg(pool_stats.reused));
+  }
+}
+
+void AerialMapDisplay::updatePipelineStatus()
+{
+  auto const now = std::chrono::steady_clock::now();
+  if (pipeline_status_time_ && now - *pipeline_status_time_ < std::chrono::seconds(1))
+  {
+    return;
+  }
+  pipeline_status_time_ = now;
+
+  detail::PipelineStats const stats = tileCache_.pipelineStats();
+  std::vector<std::pair<QString, detail::LatencyHistogram const*>> const stages{
+    { "Latency Web", &stats.web },
+    { "Latency Disk", &stats.disk },
+    { "Latency Pack", &stats.pack },
+    { "Latency Decode", &stats.decode },
+    { "Latency Upload", &upload_latency_ },
+    { "Latency Draw", &draw_latency_ },
+  };
+
+  diagnostic_msgs::DiagnosticStatus diagnostics;
+  for (auto const& stage : stages)
+  {
+    // only show the stages that a tile passed, e.g. the tiles of a tile pack aren't downloaded
+    if (stage.second->count() == 0)
+    {
+      continue;
+    }
+
+    QString const latency = formatLatency(*stage.second);
+    setStatus(StatusProperty::Ok, stage.first, latency);
+    diagnostic_msgs::KeyValue value;
+    value.key = stage.first.toStdString();
+    value.value = latency.toStdString();
+    diagnostics.values.push_back(value);
+  }
+
+  // the memory hits are counted per request of a tile, the others once per loaded tile
+  QString const sources = QString("%1 memory hits, %2 from disk, %3 from web, %4 from packs")
+                              .arg(tileCache_.stats().hits)
+                              .arg(stats.disk.count())
+                              .arg(stats.web.count())
+                              .arg(stats.pack.count());
+  QString const queue = QString("%1 queued, %2 in flight, %3 decoding, %4 retrying")
+                            .arg(stats.queued)
+                            .arg(stats.inFlight)
+                            .arg(stats.decoding)
+                            .arg(stats.retrying);
+  setStatus(StatusProperty::Ok, "Sources", sources);
+  setStatus(StatusProperty::Ok, "Queue", queue);
+
+  if (!diagnostics_pub_)
+  {
+    return;
+  }
+
+  for (auto const& entry : { std::make_pair("Sources", sources), std::make_pair("Queue", queue) })
+  {
+    diagnostic_msgs::KeyValue value;
+    value.key = entry.first;
+    value.value = entry.second.toStdString();
+    diagnostics.values.push_back(value);
+  }
+  diagnostics.level = diagnostic_msgs::DiagnosticStatus::OK;
+  diagnostics.name = "rviz_satellite: " + getName().toStdString();
+  diagnostics.message = queue.toStdString();
+
+  diagnostic_msgs::DiagnosticArray array;
+  array.header.stamp = ros::Time::now();
+  array.status.push_back(diagnostics);
+  diagnostics_pub_.publish(array);
+}
+
+void AerialMapDisplay::assembleScene()
+{
+  if (!isEnabled() || !lastCenterTile_)
+  {
+    return;
+  }
+
+  if (levels_.empty())
+  {
+    ROS_ERROR_THROTTLE_NAMED(5, "rviz_satellite", "No objects to draw on, call createTileObjects() first!");
+    return;
+  }
+
+  // material changes don't require touching any tile
+  if (material_dirty_)
+  {
+    updateMaterials();
+    material_dirty_ = false;
+  }
+
+  if (!dirty_)
+  {
+    return;
+  }
+
+  dirty_ = false;
+
+  std::vector<Area> const areas = levelAreas();
+
+  // the tile cache is only locked while looking up the tiles, not while they are uploaded
+  uploadTiles(areas);
+
+  // tile width/ height in meter
+  double const tile_w_h_m = getTileWH(ref_fix_->latitude, tileZoom());
+
+  updateTerrainReference();
+
+  bool loadedAllTiles = true;
+  for (std::size_t level = 0; level < levels_.size(); ++level)
+  {
+    loadedAllTiles = assembleLevel(level, areas, tile_w_h_m) && loadedAllTiles;
+  }
+  layout_dirty_ = false;
+
+  // since not all tiles were loaded yet, this function has to be called again
+  if (!loadedAllTiles)
+  {
+    dirty_ = true;
+  }
+
+  tileCache_.purge(areas);
+  if (!terrain_server_.empty())
+  {
+    terrain_cache_.purge(terrainAreas(areas));
+  }
+
+  checkRequestErrorRate();
+}
+
+bool AerialMapDisplay::assembleLevel(std::size_t level, std::vector<Area> const& areas, double tile_w_h_m)
+{
+  Area const& area = areas[level];
+  Level& state_of_level = levels_[level];
+  TileMesh& mesh = *state_of_level.mesh;
+  std::vector<Cell>& cells = state_of_level.cells;
+  bool const terrain = !terrain_server_.empty();
+
+  // a tile of this level covers scale x scale tiles of level 0
+  int const scale = 1 << level;
+  double const size = scale * tile_w_h_m;
+  TileCoordinate const& center = lastCenterTile_->coord;
+
+  bool loadedAllTiles = true;
+  // whether the range of heights grew, so that the bounding box has to be updated
+  bool heightsGrew = false;
+
+  // cells that are covered by the area
+  std::vector<bool> used(cells.size(), false);
+
+  // Only update the quads of cells whose visibility changed. If the layout changed, all quads have to be moved.
+  for (int xx = area.leftTop.x; xx <= area.rightBottom.x; ++xx)
+  {
+    for (int yy = area.leftTop.y; yy <= area.rightBottom.y; ++yy)
+    {
+      if (coveredByFinerLevel(areas, level, { xx, yy }))
+      {
+        continue;
+      }
+
+      std::size_t const cell = cellOf({ xx, yy });
+      used[cell] = true;
+
+      TileId const toFind{ area.center.tileServer, { xx, yy }, area.center.zoom };
+      Cell& state = cells[cell];
+
+      // Show either the wanted tile or, until it's loaded, the part of its ancestor which covers it. Don't show tiles
+      // with old textures.
+      bool const exact = state.tile && *state.tile == toFind;
+      bool const fallback = !exact && state.tile && fallback_levels_ > 0 && isAncestor(*state.tile, toFind);
+      loadedAllTiles = loadedAllTiles && exact;
+
+      boost::optional<TileId> const shown = (exact || fallback) ? state.tile : boost::none;
+      // until its DEM tile is loaded, a quad is updated on every pass
+      if (shown == state.shown && !layout_dirty_ && (!terrain || !shown || state.draped))
       {
-        // render under everything else
-        obj->setRenderQueueGroup(Ogre::RENDER_QUEUE_3);
+        continue;
       }
-      else
+      state.shown = shown;
+
+      if (exact && state.uploaded)
       {
-        obj->setRenderQueueGroup(Ogre::RENDER_QUEUE_MAIN);
+        draw_latency_.add(std::chrono::steady_clock::now() - *state.uploaded);
+        state.uploaded = boost::none;
       }
 
-      tex_unit->setAlphaOperation(Ogre::LBX_SOURCE1, Ogre::LBS_MANUAL, Ogre::LBS_CURRENT, alpha_);
+      if (!shown)
+      {
+        state.draped = false;
+        mesh.hideQuad(cell);
+        continue;
+      }
 
-      // tile width/ height in meter
-      double const tile_w_h_m = getTileWH(ref_fix_->latitude, zoom_);
+      std::vector<float> heights;
+      if (terrain)
+      {
+        heights = terrainHeightsOf(toFind, state.draped);
+        loadedAllTiles = loadedAllTiles && state.draped;
+        for (float const height : heights)
+        {
+          if (height < state_of_level.min_z || height > state_of_level.max_z)
+          {
+            state_of_level.min_z = std::min(state_of_level.min_z, height);
+            state_of_level.max_z = std::max(state_of_level.max_z, height);
+            heightsGrew = true;
+          }
+        }
+      }
 
-      // Note: In the following we will do two things:
-      //
-      // * We flip the position's y coordinate.
-      // * We flip the texture's v coordinate.
-      //
-      // For more explanation see the function transformAerialMap()
+      // Note: In the following we flip the position's y coordinate. For more explanation see the function
+      // transformAerialMap()
 
       // The center tile has the coordinates left-bot = (0,0) and right-top = (1,1) in the AerialMap frame.
-      double const x = (xx - lastCenterTile_->coord.x) * tile_w_h_m;
-      // flip the y coordinate because we need to flip the tiles to align the tile's frame with the ENU "map" frame
-      double const y = -(yy - lastCenterTile_->coord.y) * tile_w_h_m;
-
-      // create a quad for this tile
-      // note: We have to recreate the vertices and cannot reuse the old vertices: tile_w_h_m depends on the latitude
-      obj->clear();
-
-      obj->begin(material->getName(), Ogre::RenderOperation::OT_TRIANGLE_LIST);
-
-      // We assign the Ogre texture coordinates in a way so that we flip the
-      // texture along the v coordinate. For example, we assign the bottom left
-      //
-      // Note that the Ogre texture coordinate system is: (0,0) = top left of the loaded image and (1,1) = bottom right
-      // of the loaded image
-
-      // bottom left
-      obj->position(x, y, 0.0f);
-      obj->textureCoord(0.0f, 0.0f);
-      obj->normal(0.0f, 0.0f, 1.0f);
-
-      // top right
-      obj->position(x + tile_w_h_m, y + tile_w_h_m, 0.0f);
-      obj->textureCoord(1.0f, 1.0f);
-      obj->normal(0.0f, 0.0f, 1.0f);
-
-      // top left
-      obj->position(x, y + tile_w_h_m, 0.0f);
-      obj->textureCoord(0.0f, 1.0f);
-      obj->normal(0.0f, 0.0f, 1.0f);
-
-      // bottom left
-      obj->position(x, y, 0.0f);
-      obj->textureCoord(0.0f, 0.0f);
-      obj->normal(0.0f, 0.0f, 1.0f);
-
-      // bottom right
-      obj->position(x + tile_w_h_m, y, 0.0f);
-      obj->textureCoord(1.0f, 0.0f);
-      obj->normal(0.0f, 0.0f, 1.0f);
-
-      // top right
-      obj->position(x + tile_w_h_m, y + tile_w_h_m, 0.0f);
-      obj->textureCoord(1.0f, 1.0f);
-      obj->normal(0.0f, 0.0f, 1.0f);
-
-      obj->end();
+      double const x = (xx * scale - center.x) * tile_w_h_m;
+      // flip the y coordinate because we need to flip the tiles to align the tile's frame with the ENU "map" frame;
+      // the bottom of a coarser tile is the bottom of the southernmost tile of level 0 that it covers
+      double const y = -((yy + 1) * scale - 1 - center.y) * tile_w_h_m;
+
+      mesh.setQuad(cell, x, y, size, exact ? AtlasRect{ 0, 0, 1, 1 } : ancestorRegion(*shown, toFind), heights);
     }
   }
 
-  // since not all tiles were loaded yet, this function has to be called again
-  if (!loadedAllTiles)
+  if (layout_dirty_)
   {
-    dirty_ = true;
+    // hide cells that are outside of the area, e.g. at the border of the world or inside the finer level
+    for (std::size_t cell = 0; cell < cells.size(); ++cell)
+    {
+      if (!used[cell] && cells[cell].shown)
+      {
+        cells[cell].shown = boost::none;
+        cells[cell].draped = false;
+        mesh.hideQuad(cell);
+      }
+    }
   }
 
-  tileCache_.purge({ *lastCenterTile_, blocks_ });
+  if (layout_dirty_ || heightsGrew)
+  {
+    double const min_x = (area.leftTop.x * scale - center.x) * tile_w_h_m;
+    double const max_x = ((area.rightBottom.x + 1) * scale - center.x) * tile_w_h_m;
+    double const min_y = -((area.rightBottom.y + 1) * scale - 1 - center.y) * tile_w_h_m;
+    double const max_y = -(area.leftTop.y * scale - center.y - 1) * tile_w_h_m;
+    mesh.setBoundingBox(
+        Ogre::AxisAlignedBox(min_x, min_y, state_of_level.min_z, max_x, max_y, state_of_level.max_z));
+  }
 
-  checkRequestErrorRate();
+  return loadedAllTiles;
 }
 
 /**
@@ -603,25 +1630,19 @@ void AerialMapDisplay::assembleScene()
  */
 double AerialMapDisplay::getTileWH(double const latitude, int const zoom) const
 {
-  // this constant origins from how the base resolution is calculated
-  //
-  // see https://wiki.openstreetmap.org/wiki/Slippy_map_tilenames
-  //
-  // TODO: actually this not needed and could be removed from both formulas, since they cancel out each other;
-  // it origins from most tile map applications directly rendering images with pixel dimensions;
-  // in here we have OpenGL, pixel do not matter, only meters
-  int constexpr tile_w_h_px = 256;
+  // The tile size in pixels cancels out: a tile covers the same area at a zoom level, no matter how many pixels it
+  // has, see https://wiki.openstreetmap.org/wiki/Slippy_map_tilenames
 
   // meter/pixel
-  auto const resolution = zoomToResolution(latitude, zoom);
+  auto const resolution = zoomToResolution(latitude, zoom, tile_size_);
   // gives tile size (with and height) in meter
-  double const tile_w_h_m = tile_w_h_px * resolution;
+  double const tile_w_h_m = tile_size_ * resolution;
   return tile_w_h_m;
 }
 
-void AerialMapDisplay::transformTileToMapFrame()
+void AerialMapDisplay::transformTileToMapFrame(sensor_msgs::NavSatFixConstPtr const& fix)
 {
-  if (not ref_fix_)
+  if (not ref_fix_ or not lastCenterTile_)
   {
     ROS_FATAL_THROTTLE_NAMED(2, "rviz_satellite", "ref_fix_  not set, can't create transforms");
     return;
@@ -645,28 +1666,34 @@ void AerialMapDisplay::transformTileToMapFrame()
 
   std::string error;
   bool const gotTransform =
-      getMapTransform(ref_fix_->header.frame_id, ref_fix_->header.stamp, t_navsat_map, o_navsat_map, error);
+      getMapTransform(fix->header.frame_id, fix->header.stamp, t_navsat_map, o_navsat_map, error);
   if (not gotTransform)
   {
     setStatus(StatusProperty::Error, "Transform", QString::fromStdString(error));
     return;
   }
 
-  auto const centerTile = fromWGSCoordinate<double>({ ref_fix_->latitude, ref_fix_->longitude }, zoom_);
+  auto const position = fromWGSCoordinate<double>({ fix->latitude, fix->longitude }, tileZoom());
 
   // In assembleScene() we shift the AerialMap so that the center tile's left-bottom corner has the coordinate (0,0).
-  // Therefore we can calculate the NavSatFix coordinate (in the AerialMap frame) by just looking at the fractional part
-  // of the coordinate. That is we calculate the offset from the left bottom corner of the center tile.
-  auto const centerTileOffsetX = centerTile.x - std::floor(centerTile.x);
+  // Therefore we can calculate the NavSatFix coordinate (in the AerialMap frame) by looking at the offset from the
+  // left bottom corner of the center tile. The fix may be a bit outside of the center tile, until the center tile is
+  // updated, see navFixCallback().
+  auto const centerTileOffsetX = position.x - lastCenterTile_->coord.x;
   // In assembleScene() the tiles are created so that the texture is flipped along the y coordinate. Since we want to
   // calculate the positions of the center tile, we also need to flip the texture's v coordinate here.
-  auto const centerTileOffsetY = 1 - (centerTile.y - std::floor(centerTile.y));
+  auto const centerTileOffsetY = 1 - (position.y - lastCenterTile_->coord.y);
 
-  double const tile_w_h_m = getTileWH(ref_fix_->latitude, zoom_);
+  double const tile_w_h_m = getTileWH(ref_fix_->latitude, tileZoom());
   ROS_DEBUG_NAMED("rviz_satellite", "Tile resolution is %.1fm", tile_w_h_m);
 
+  // the terrain has the height 0 at the position of ref_fix_, see updateTerrainReference()
+  boost::optional<float> const elevation = terrain_reference_ ? terrainElevationAt({ fix->latitude, fix->longitude }) :
+                                                                boost::none;
+  double const height = elevation ? *elevation - *terrain_reference_ : 0.0;
+
   auto const translationAerialMapToNavSatFix =
-      Ogre::Vector3(centerTileOffsetX * tile_w_h_m, centerTileOffsetY * tile_w_h_m, 0);
+      Ogre::Vector3(centerTileOffsetX * tile_w_h_m, centerTileOffsetY * tile_w_h_m, height);
   auto const translationNavSatFixToAerialMap = -translationAerialMapToNavSatFix;
 
   t_centertile_map = t_navsat_map + translationNavSatFixToAerialMap;
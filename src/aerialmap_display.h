@@ -16,7 +16,9 @@ limitations under the License. */
 
 // NOTE: workaround for issue: https://bugreports.qt.io/browse/QTBUG-22829
 #ifndef Q_MOC_RUN
+#include <ros/callback_queue.h>
 #include <ros/ros.h>
+#include <ros/spinner.h>
 #include <ros/time.h>
 #include <rviz/display.h>
 #include <sensor_msgs/NavSatFix.h>
@@ -35,19 +37,23 @@ limitations under the License. */
 #include <QFile>
 #include <QNetworkRequest>
 
+#include <chrono>
 #include <string>
 #include <vector>
 #include <memory>
+#include <mutex>
 #include "TileCacheDelay.h"
-#include "OgreTile.h"
-
-namespace Ogre
-{
-class ManualObject;
-}
+#include "AtlasPagePool.h"
+#include "TileAtlas.h"
+#include "TileMesh.h"
+#include "TileImage.h"
+#include "Prefetch.h"
+#include "Terrain.h"
+#include "ViewFootprint.h"
 
 namespace rviz
 {
+class EnumProperty;
 class FloatProperty;
 class IntProperty;
 class Property;
@@ -76,7 +82,19 @@ protected Q_SLOTS:
   void updateDrawUnder();
   void updateTileUrl();
   void updateZoom();
+  void updateTileSize();
   void updateBlocks();
+  void updateUploadBudget();
+  void updateCacheSize();
+  void updateDiskCache();
+  void updateTileServerSettings();
+  void updatePrefetch();
+  void updateFallbackLevels();
+  void updateLodLevels();
+  void updateMipmaps();
+  void updateTerrain();
+  void updateViewFrustum();
+  void updateDiagnostics();
 
 protected:
   // overrides from Display
@@ -87,29 +105,143 @@ protected:
   virtual void unsubscribe();
 
   /**
-   * GPS topic callback
+   * GPS topic callback, called on the thread of fix_queue_
+   *
+   * Stores the message for processPendingFix() and checks whether it left the bounds of the center tile.
    */
   void navFixCallback(sensor_msgs::NavSatFixConstPtr const& msg);
 
+  /**
+   * Process the latest message received by navFixCallback() since the last frame, if any
+   *
+   * Only if the message may have left the center tile, the center tile is updated. Otherwise only the transform of the
+   * tiles is updated.
+   */
+  void processPendingFix();
+
   /**
    * Load images to cache (non-blocking)
    */
   void requestTileTextures();
-  void updateCenterTile(sensor_msgs::NavSatFixConstPtr const& msg);
+
+  /**
+   * Update the center tile to the tile of @p msg
+   * @return whether the center tile changed
+   */
+  bool updateCenterTile(sensor_msgs::NavSatFixConstPtr const& msg);
+
+  /**
+   * The zoom level of the tiles of level 0, which have the resolution of the configured zoom level, see
+   * tileZoomOffset()
+   */
+  int tileZoom() const;
+
+  /**
+   * The number of blocks around the center tile of level 0, which cover about the area of the configured blocks of
+   * 256 pixel tiles, see scaleBlocks()
+   */
+  int tileBlocks() const;
+
+  /**
+   * The number of coarser zoom levels shown around the configured zoom level, see levels_
+   */
+  int lodLevels() const;
+
+  /**
+   * The areas of all levels_ around the center tile, the finest level first
+   *
+   * The area of level k is centered on the ancestor of the center tile at tileZoom() - k. Except for the coarsest
+   * level, the areas are extended to whole tiles of the next coarser level, so that the next level can leave out
+   * exactly the tiles which are covered by the finer one.
+   */
+  std::vector<Area> levelAreas() const;
+
+  /**
+   * Intersect the view of the camera with the map plane, and request the tiles again if the visible areas changed
+   *
+   * If the map is shown in the view only (see view_frustum_), the areas of the levels_ are centered on the visible tile
+   * nearest to the camera instead of the center tile, so that the map is most detailed where it is seen from the
+   * least distance, and every area is clipped to the tiles that the camera sees.
+   */
+  void updateViewFootprint();
+
+  /**
+   * The tile of level 0 at the focus of the view_footprint_, see ViewFootprint::focus
+   */
+  TileId viewFocusTile(double tile_w_h_m) const;
+
+  /**
+   * Restrict the @p area of the level @p level to the tiles which cover the bounding box of the view_footprint_. If
+   * none of its tiles is visible, only the tile nearest to the view is kept.
+   */
+  Area clipToView(Area area, int level, double tile_w_h_m) const;
+
+  /**
+   * The areas of the DEM tiles that cover the @p areas of the levels_, see terrainAreaOf()
+   */
+  std::vector<Area> terrainAreas(std::vector<Area> const& areas) const;
+
+  /**
+   * Determine the elevation at the position of ref_fix_, which is the height 0 of the terrain, if its DEM tile is
+   * cached
+   */
+  void updateTerrainReference();
+
+  /**
+   * The elevation at @p coord, if its DEM tile is cached
+   */
+  boost::optional<float> terrainElevationAt(WGSCoordinate const& coord) const;
+
+  /**
+   * The height field of the tile @p tileId, see terrainHeights()
+   *
+   * Until the DEM tile of @p tileId is loaded, the height field is sampled from its nearest cached ancestor.
+   *
+   * @param exact is set to whether the height field was sampled from the DEM tile of @p tileId
+   * @return the height field or an empty vector if no DEM tile or the reference elevation isn't available yet
+   */
+  std::vector<float> terrainHeightsOf(TileId const& tileId, bool& exact) const;
+
+  /**
+   * The atlas cell of the tile at @p coord
+   *
+   * The cells form a ring buffer, i.e. they are indexed by the tile coordinate modulo the grid size. Therefore a tile
+   * keeps its cell (and its uploaded texture) while the center tile moves, and only the newly exposed row or column of
+   * tiles has to be uploaded.
+   */
+  std::size_t cellOf(TileCoordinate const& coord) const;
+
+  /**
+   * Upload the ready tiles of the @p areas of all levels_ into their atlases, the ones of finer levels and nearest to
+   * the center first, within the configured per-frame budget. For tiles that aren't ready, their nearest cached
+   * ancestor is uploaded instead.
+   */
+  void uploadTiles(std::vector<Area> const& areas);
+
+  /**
+   * Update the quads of the level @p level whose visibility changed, or all quads if the layout changed
+   * @return whether all tiles of the level are shown with their own texture
+   */
+  bool assembleLevel(std::size_t level, std::vector<Area> const& areas, double tile_w_h_m);
 
   /**
    * Create geometry
    */
   void assembleScene();
 
+  /**
+   * Configure depth & alpha properties of the tile materials
+   */
+  void updateMaterials();
+
   void clearAll();
   void destroyTileObjects();
   void createTileObjects();
 
   /**
-   * @brief Transforms the tile objects into the map frame.
+   * @brief Transforms the tile objects into the map frame, so that the position of @p fix is at its frame.
    */
-  void transformTileToMapFrame();
+  void transformTileToMapFrame(sensor_msgs::NavSatFixConstPtr const& fix);
 
   /**
    * @brief Transforms the tile objects into the fixed frame.
@@ -130,27 +262,80 @@ protected:
    */
   void checkRequestErrorRate();
 
+  /**
+   * @brief Shows the memory usage and hit rate of the tile cache and the occupancy of the disk cache in the status, if
+   * they changed.
+   */
+  void updateCacheStatus();
+
+  /**
+   * Shows the latencies of the stages of loading and drawing the tiles, the sources of the tiles and the queue depths
+   * in the status at most once per second, and publishes them as diagnostics if enabled.
+   *
+   * The stages are: queued until received from the web, the disk cache or a tile pack, until decoded (see
+   * detail::PipelineStats), then until uploaded to the GPU and until its quad is shown.
+   */
+  void updatePipelineStatus();
+
   /**
    * Calculate the tile width/ height in meter
    */
   double getTileWH(double const latitude, int const zoom) const;
 
   /**
-   * Tile with associated Ogre data
+   * State of a cell of the atlas of a Level, i.e. of a tile slot of its grid, see cellOf()
    */
-  struct MapObject
+  struct Cell
   {
-    Ogre::ManualObject* object;
-    Ogre::MaterialPtr material;
+    /// the tile that is currently uploaded into the cell, either the wanted tile or one of its ancestors
+    boost::optional<TileId> tile;
+    /// the tile that the cell's quad currently shows, none if the quad is hidden
+    boost::optional<TileId> shown;
+    /// whether the quad is draped on the DEM tile that covers it, see terrainHeightsOf()
+    bool draped{ false };
+    /// when the wanted tile was uploaded, until its quad is shown, see draw_latency_
+    boost::optional<std::chrono::steady_clock::time_point> uploaded;
+  };
+
+  /// keeps the textures and materials of the atlases when the levels are re-created, declared before `levels_`
+  AtlasPagePool page_pool_;
+  /// the page pool statistics shown in the status
+  boost::optional<AtlasPagePoolStats> page_pool_stats_;
 
-    MapObject(Ogre::ManualObject* o, Ogre::MaterialPtr m) : object(o), material(m)
-    {
-      assert(!material.isNull());
-    }
+  /**
+   * A grid of tiles of one zoom level
+   *
+   * Level 0 shows the tiles at tileZoom(). Level k shows the tiles at tileZoom() - k around the area of level k - 1,
+   * which covers the center, so that the map reaches further with every level while the number of tiles grows only
+   * linearly.
+   */
+  struct Level
+  {
+    /// textures of the tiles, with one cell per tile of the grid
+    std::unique_ptr<TileAtlas> atlas;
+    /// the geometry of all tiles
+    std::unique_ptr<TileMesh> mesh;
+    std::vector<Cell> cells;
+    /// the range of the heights of the quads, which is part of the bounding box of the mesh
+    float min_z{ 0 };
+    float max_z{ 0 };
   };
-  std::vector<MapObject> objects_;
+  std::vector<Level> levels_;
+  /// width/ height of the grid of each level in tiles, see cellOf()
+  int grid_size_{ 0 };
 
   ros::Subscriber coord_sub_;
+  /// the NavSatFix messages are received on their own thread, see navFixCallback()
+  ros::CallbackQueue fix_queue_;
+  std::unique_ptr<ros::AsyncSpinner> fix_spinner_;
+  /// guards the state that navFixCallback() shares with the render thread
+  std::mutex fix_mutex_;
+  /// the latest message that wasn't processed yet, see processPendingFix()
+  sensor_msgs::NavSatFixConstPtr pending_fix_;
+  /// whether one of the messages since the last frame may have left the center tile
+  bool pending_transition_{ false };
+  /// the bounds of the center tile, none if there is no center tile yet
+  boost::optional<WGSBounds> center_bounds_;
 
   // properties
   RosTopicProperty* topic_property_;
@@ -159,20 +344,79 @@ protected:
   IntProperty* blocks_property_;
   FloatProperty* alpha_property_;
   Property* draw_under_property_;
+  IntProperty* upload_tiles_property_;
+  FloatProperty* upload_time_property_;
+  IntProperty* cache_size_property_;
+  IntProperty* disk_cache_size_property_;
+  IntProperty* disk_cache_age_property_;
+  IntProperty* max_requests_property_;
+  Property* http2_property_;
+  EnumProperty* tile_size_property_;
+  FloatProperty* prefetch_property_;
+  IntProperty* fallback_levels_property_;
+  IntProperty* lod_levels_property_;
+  Property* view_frustum_property_;
+  Property* mipmaps_property_;
+  StringProperty* terrain_url_property_;
+  EnumProperty* terrain_encoding_property_;
+  Property* diagnostics_property_;
 
   float alpha_;
   bool draw_under_;
-  std::string tile_url_;
+  TileServer tile_server_;
   int zoom_;
+  /// width/ height of the tiles of tile_server_ in pixels
+  int tile_size_;
   int blocks_;
+  /// max. number of tiles that are uploaded to the GPU per frame (0 = unlimited)
+  int upload_tiles_;
+  /// max. time in ms spent uploading tiles to the GPU per frame
+  float upload_time_;
+  /// how many seconds to look ahead when prefetching tiles (0 = disabled)
+  float prefetch_time_;
+  /// how many zoom levels above to search for a tile to show until a tile is loaded (0 = disabled)
+  int fallback_levels_;
+  /// how many coarser zoom levels to show around the configured zoom level (0 = disabled)
+  int lod_levels_;
+  /// whether only the tiles that the camera sees are loaded, see updateViewFootprint()
+  bool view_frustum_;
+  /// the visible part of the map plane, relative to the center tile like the quads of the tiles
+  boost::optional<ViewFootprint> view_footprint_;
+  /// the areas of the levels for the last view_footprint_
+  std::vector<Area> view_areas_;
+  /// whether the tile textures have mipmaps
+  bool mipmaps_;
+  /// the tile server of the DEM tiles, the tiles are flat if it is empty
+  TileServer terrain_server_;
+  TerrainEncoding terrain_encoding_;
 
   // tile management
   /// whether we need to re-query and re-assemble the tiles
   bool dirty_;
+  /// whether the position of all tiles changed, e.g. because the center tile changed
+  bool layout_dirty_{ true };
+  /// whether the alpha or draw under property changed
+  bool material_dirty_{ true };
   /// the last NavSatFix message that lead to updating the tiles
   sensor_msgs::NavSatFixConstPtr ref_fix_{ nullptr };
   /// caches tile images, hashed by their fetch URL
-  TileCacheDelay<OgreTile> tileCache_;
+  TileCacheDelay<TileImage> tileCache_;
+  /// the cache statistics shown in the status
+  boost::optional<TileCacheStats> cache_stats_;
+  boost::optional<detail::DiskCacheStats> disk_cache_stats_;
+  /// caches the DEM tiles, see terrain_server_
+  TileCache<TileImage> terrain_cache_;
+  /// the elevation at the position of ref_fix_, see updateTerrainReference()
+  boost::optional<float> terrain_reference_;
+  /// from loading a tile into the cache until it is uploaded, and from then until its quad is shown
+  detail::LatencyHistogram upload_latency_;
+  detail::LatencyHistogram draw_latency_;
+  /// when the pipeline status was updated last, see updatePipelineStatus()
+  boost::optional<std::chrono::steady_clock::time_point> pipeline_status_time_;
+  /// publishes the pipeline status on /diagnostics, if enabled
+  ros::Publisher diagnostics_pub_;
+  /// estimates the velocity from the NavSatFix messages for prefetching tiles
+  VelocityEstimator velocity_;
   /// Last request()ed tile id (which is the center tile)
   boost::optional<TileId> lastCenterTile_;
   /// translation of the center-tile w.r.t. the map frame
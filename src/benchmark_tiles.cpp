@@ -0,0 +1,371 @@
+/* Copyright 2018-2019 TomTom N.V.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License. */
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <QBuffer>
+#include <QByteArray>
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QHostAddress>
+#include <QImage>
+#include <QStringList>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTimer>
+#include <boost/optional.hpp>
+
+#include "Area.h"
+#include "Coordinates.h"
+#include "General.h"
+#include "Route.h"
+#include "TileCache.h"
+#include "TileId.h"
+#include "TileImage.h"
+#include "detail/ImagePool.h"
+#include "detail/PipelineStats.h"
+#include "detail/TileDecoder.h"
+
+/**
+ * @file
+ * Command line tool that measures the stages of the tile pipeline, so that optimizations can be justified and
+ * regressions caught with numbers.
+ *
+ * It replays the route of a bag file against a local mock tile server and measures the time from reaching a new center
+ * tile until all tiles around it are loaded. Afterwards, it measures the throughput of the TileCache on the loaded map
+ * and of the hashing, coordinate conversion and decoding of the tiles. Uploading the tiles to the GPU needs a render
+ * window, so it isn't covered, see the "Latency Upload" status of the display instead.
+ */
+
+namespace
+{
+using Clock = std::chrono::steady_clock;
+
+/// keeps the compiler from optimizing away the measured code
+std::size_t volatile sink = 0;
+
+/**
+ * Call @p body with 0, ..., @p iterations - 1 and print the mean time per call
+ */
+void measure(std::string const& name, std::size_t iterations, std::function<std::size_t(std::size_t)> const& body)
+{
+  std::size_t checksum = 0;
+  auto const start = Clock::now();
+  for (std::size_t i = 0; i < iterations; ++i)
+  {
+    checksum += body(i);
+  }
+  double const ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / iterations;
+  sink = sink + checksum;
+
+  std::cout << std::left << std::setw(32) << name << std::right << std::setw(14) << std::fixed << std::setprecision(1)
+            << ns << " ns/op" << std::endl;
+}
+
+void printLatency(std::string const& name, detail::LatencyHistogram const& histogram)
+{
+  std::cout << std::left << std::setw(32) << name << std::right << std::fixed << std::setprecision(0) << "p50 "
+            << histogram.quantileMs(0.5) << " ms, p90 " << histogram.quantileMs(0.9) << " ms, max "
+            << histogram.maxMs() << " ms, mean " << histogram.meanMs() << " ms (" << histogram.count() << ")"
+            << std::endl;
+}
+
+/**
+ * A tile with some structure, so that its encoded size is closer to a real tile than a plain color
+ */
+QByteArray encodedTile(int tileSize, char const* format)
+{
+  QImage image(tileSize, tileSize, QImage::Format_RGB32);
+  for (int y = 0; y < tileSize; ++y)
+  {
+    for (int x = 0; x < tileSize; ++x)
+    {
+      image.setPixel(x, y, qRgb((x * 7) ^ y, (y * 5) ^ x, (x + y) * 3));
+    }
+  }
+
+  QByteArray data;
+  QBuffer buffer(&data);
+  buffer.open(QIODevice::WriteOnly);
+  image.save(&buffer, format);
+  return data;
+}
+
+/**
+ * An HTTP server on localhost that answers every request with the same PNG tile after an optional delay
+ *
+ * The responses forbid caching them, so that every run downloads all tiles again instead of reading the disk cache.
+ */
+class MockTileServer
+{
+public:
+  MockTileServer(QByteArray const& tile, int delayMs) : delayMs_(delayMs)
+  {
+    response_ = QByteArray("HTTP/1.1 200 OK\r\nContent-Type: image/png\r\nCache-Control: no-store\r\n") +
+                "Content-Length: " + QByteArray::number(tile.size()) + "\r\n\r\n" + tile;
+
+    if (!server_.listen(QHostAddress::LocalHost))
+    {
+      throw std::runtime_error("Could not start the mock tile server: " + server_.errorString().toStdString());
+    }
+    QObject::connect(&server_, &QTcpServer::newConnection, [this]() { accept(); });
+  }
+
+  std::string url() const
+  {
+    return "http://127.0.0.1:" + std::to_string(server_.serverPort()) + "/{z}/{x}/{y}.png";
+  }
+
+  std::size_t requests() const
+  {
+    return requests_;
+  }
+
+private:
+  void accept()
+  {
+    while (QTcpSocket* socket = server_.nextPendingConnection())
+    {
+      QObject::connect(socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater);
+      // the connections are kept alive, so a socket receives many requests
+      auto const received = std::make_shared<QByteArray>();
+      QObject::connect(socket, &QIODevice::readyRead, socket, [this, socket, received]() {
+        received->append(socket->readAll());
+        int end = 0;
+        while ((end = received->indexOf("\r\n\r\n")) >= 0)
+        {
+          received->remove(0, end + 4);
+          ++requests_;
+          respond(socket);
+        }
+      });
+    }
+  }
+
+  void respond(QTcpSocket* socket)
+  {
+    if (delayMs_ <= 0)
+    {
+      socket->write(response_);
+      return;
+    }
+
+    // timers with the same interval fire in order, so the responses keep the order of the requests
+    QByteArray const response = response_;
+    QTimer::singleShot(delayMs_, socket, [socket, response]() { socket->write(response); });
+  }
+
+  QTcpServer server_;
+  QByteArray response_;
+  int delayMs_;
+  std::size_t requests_{ 0 };
+};
+
+/**
+ * Move along the @p route and measure the time from reaching a new center tile until all tiles of the area around it
+ * are ready in the @p cache, like the display does without prefetching and fallback tiles
+ */
+detail::LatencyHistogram replayRoute(TileCache<TileImage>& cache, TileServer const& tileServer,
+                                     std::vector<WGSCoordinate> const& route, int zoom, int blocks,
+                                     std::chrono::seconds timeout)
+{
+  // wakes up the event loop to check the timeout
+  QTimer wakeUp;
+  wakeUp.start(100);
+
+  detail::LatencyHistogram timeToFullMap;
+  boost::optional<TileCoordinate> center;
+  for (WGSCoordinate const& position : route)
+  {
+    TileCoordinate const coord = fromWGSCoordinate(position, zoom);
+    if (center && *center == coord)
+    {
+      continue;
+    }
+    center = coord;
+
+    Area const area({ tileServer, coord, zoom }, blocks);
+    std::vector<TileId> const tiles = areaTilesCenterOut(area);
+    auto const start = Clock::now();
+    cache.request({ area });
+    auto const ready = [&cache](TileId const& tileId) { return cache.ready(tileId) != nullptr; };
+    while (!std::all_of(tiles.begin(), tiles.end(), ready))
+    {
+      if (Clock::now() - start > timeout)
+      {
+        throw std::runtime_error("The map wasn't complete after " + std::to_string(timeout.count()) + " s");
+      }
+      QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents);
+    }
+    timeToFullMap.add(Clock::now() - start);
+    cache.purge({ area });
+  }
+  return timeToFullMap;
+}
+}  // namespace
+
+int main(int argc, char** argv)
+{
+  QCoreApplication app(argc, argv);
+  QCoreApplication::setApplicationName("benchmark_tiles");
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription("Measure the stages of the tile pipeline of rviz_satellite against a local mock "
+                                   "tile server.");
+  parser.addHelpOption();
+
+  QCommandLineOption const bagOption("bag", "Bag file with sensor_msgs/NavSatFix messages whose route to replay "
+                                            "(default: only the first position).",
+                                     "file");
+  QCommandLineOption const topicOption("topic", "NavSatFix topic in the bag file (default: all NavSatFix topics).",
+                                       "topic");
+  QCommandLineOption const positionOption("position", "Position of the map without a bag file.", "lat,lon",
+                                          "39.9522,-75.1932");
+  QCommandLineOption const zoomOption({ "z", "zoom" }, "Zoom level of the tiles.", "zoom", "18");
+  QCommandLineOption const blocksOption("blocks", "Adjacent blocks to load around the center tile.", "blocks",
+                                        QString::number(maxBlocks));
+  QCommandLineOption const delayOption("delay", "Delay of every response of the mock tile server in ms.", "ms", "0");
+  QCommandLineOption const maxRequestsOption("max-requests", "Max. number of parallel requests.", "requests", "6");
+  QCommandLineOption const iterationsOption("iterations", "Number of iterations of the micro benchmarks.",
+                                            "iterations", "100000");
+  parser.addOptions({ bagOption, topicOption, positionOption, zoomOption, blocksOption, delayOption, maxRequestsOption,
+                      iterationsOption });
+  parser.process(app);
+
+  try
+  {
+    bool okZoom = false;
+    bool okBlocks = false;
+    bool okDelay = false;
+    bool okRequests = false;
+    bool okIterations = false;
+    int const zoom = parser.value(zoomOption).toInt(&okZoom);
+    int const blocks = parser.value(blocksOption).toInt(&okBlocks);
+    int const delay = parser.value(delayOption).toInt(&okDelay);
+    int const maxRequests = parser.value(maxRequestsOption).toInt(&okRequests);
+    int const iterations = parser.value(iterationsOption).toInt(&okIterations);
+    if (!okZoom || zoom < 0 || zoom > maxZoom || !okBlocks || blocks < 0 || blocks > maxBlocks || !okDelay ||
+        delay < 0 || !okRequests || maxRequests <= 0 || !okIterations || iterations <= 0)
+    {
+      throw std::invalid_argument("Invalid option, see --help");
+    }
+
+    std::vector<WGSCoordinate> route;
+    if (parser.isSet(bagOption))
+    {
+      route = readRoute(parser.value(bagOption).toStdString(), parser.value(topicOption).toStdString());
+      if (route.empty())
+      {
+        throw std::invalid_argument("The bag file has no valid NavSatFix messages");
+      }
+    }
+    else
+    {
+      QStringList const parts = parser.value(positionOption).split(',');
+      bool okLat = false;
+      bool okLon = false;
+      route.push_back({ parts.front().toDouble(&okLat), parts.back().toDouble(&okLon) });
+      if (parts.size() != 2 || !okLat || !okLon)
+      {
+        throw std::invalid_argument("Invalid position, expected lat,lon");
+      }
+    }
+
+    QByteArray const png = encodedTile(tileSizePx, "PNG");
+    QByteArray const jpeg = encodedTile(tileSizePx, "JPEG");
+    MockTileServer server(png, delay);
+    TileServer const tileServer(server.url());
+
+    TileCache<TileImage> cache;
+    // like the default "Cache Size" of the display
+    cache.setMaxBytes(256 * 1024 * 1024);
+    detail::TileServerSettings settings;
+    settings.maxRequests = static_cast<std::size_t>(maxRequests);
+    cache.setTileServerSettings(tileServer, settings);
+
+    // end-to-end: queued, downloaded, decoded and ready in the cache
+    std::cout << "Replaying " << route.size() << " positions at zoom level " << zoom << " with " << blocks
+              << " blocks" << std::endl;
+    auto const start = Clock::now();
+    detail::LatencyHistogram const timeToFullMap =
+        replayRoute(cache, tileServer, route, zoom, blocks, std::chrono::seconds(60));
+    double const seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    std::cout << "Served " << server.requests() << " tiles in " << std::setprecision(2) << seconds << " s" << std::endl;
+
+    printLatency("time to full map", timeToFullMap);
+    detail::PipelineStats const stats = cache.pipelineStats();
+    printLatency("queued until downloaded", stats.web);
+    printLatency("decoded", stats.decode);
+
+    // the cache holds the area of the last position of the route
+    Area const area({ tileServer, fromWGSCoordinate(route.back(), zoom), zoom }, blocks);
+    std::vector<TileId> const tiles = areaTilesCenterOut(area);
+    std::size_t const n = tiles.size();
+    std::cout << "Micro benchmarks with " << n << " tiles" << std::endl;
+
+    std::size_t const areaIterations = std::max<std::size_t>(1, iterations / n);
+    measure("TileCache::request (area)", areaIterations, [&](std::size_t) {
+      cache.request({ area });
+      return std::size_t{ 0 };
+    });
+    measure("TileCache::ready", iterations,
+            [&](std::size_t i) { return static_cast<std::size_t>(cache.ready(tiles[i % n]) != nullptr); });
+    measure("TileCache::purge (area)", areaIterations, [&](std::size_t) {
+      cache.purge({ area });
+      return std::size_t{ 0 };
+    });
+    measure("std::hash<TileId>", iterations, [&](std::size_t i) { return std::hash<TileId>()(tiles[i % n]); });
+
+    WGSCoordinate const& position = route.back();
+    measure("fromWGSCoordinate", iterations, [&](std::size_t i) {
+      // a new coordinate for every call, within about a kilometer around the position
+      double const offset = (i % 1024) * 1e-5;
+      TileCoordinate const coord = fromWGSCoordinate({ position.lat + offset, position.lon - offset }, zoom);
+      return static_cast<std::size_t>(coord.x + coord.y);
+    });
+
+    std::size_t const decodeIterations = std::max(1, iterations / 100);
+    for (auto const& encoded : { std::make_pair("decodeTile (PNG)", png), std::make_pair("decodeTile (JPEG)", jpeg) })
+    {
+      if (encoded.second.isEmpty())
+      {
+        std::cout << encoded.first << ": no image plugin" << std::endl;
+        continue;
+      }
+      measure(encoded.first, decodeIterations, [&](std::size_t) {
+        QImage image = detail::decodeTile(encoded.second, false);
+        std::size_t const bytes = static_cast<std::size_t>(image.byteCount());
+        // like a TileImage, so that the buffers are reused
+        detail::ImagePool::instance().release(std::move(image));
+        return bytes;
+      });
+    }
+
+    return 0;
+  }
+  catch (std::exception const& e)
+  {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+}
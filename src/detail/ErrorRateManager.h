@@ -14,25 +14,37 @@ limitations under the License. */
 
 #pragma once
 
+#include <chrono>
+#include <cstddef>
+#include <deque>
 #include <unordered_map>
+#include <utility>
 
 namespace detail
 {
 /**
  * Manage error rates from entities of type T
+ *
+ * Only the outcomes within a sliding time window are taken into account, so that the error rate recovers after a burst
+ * of errors.
  */
 template <typename T>
 struct ErrorRateManager
 {
+  using Clock = std::chrono::steady_clock;
+
+  /// Length of the sliding window
+  static constexpr std::chrono::seconds window{ 30 };
+
   struct ErrorRate
   {
-    int total_num;
-    int error_num;
+    /// time and whether it was an error, oldest first
+    std::deque<std::pair<Clock::time_point, bool>> outcomes;
   };
   std::unordered_map<T, ErrorRate> errorRates;
 
   /**
-   * Calculate the error rate of an entity
+   * Calculate the error rate of an entity within the last `window`
    */
   float calculate(T const& id) const
   {
@@ -42,14 +54,24 @@ struct ErrorRateManager
       return 0;
     }
 
-    auto const& rate = it->second;
+    Clock::time_point const begin = Clock::now() - window;
+    std::size_t total_num = 0;
+    std::size_t error_num = 0;
+    for (auto const& outcome : it->second.outcomes)
+    {
+      if (outcome.first >= begin)
+      {
+        ++total_num;
+        error_num += outcome.second ? 1 : 0;
+      }
+    }
 
-    if (rate.total_num == 0)
+    if (total_num == 0)
     {
       return 0;
     }
 
-    return static_cast<float>(rate.error_num) / rate.total_num;
+    return static_cast<float>(error_num) / total_num;
   }
 
   /**
@@ -57,9 +79,7 @@ struct ErrorRateManager
    */
   void issueError(T const& id)
   {
-    auto& rate = errorRates[id];
-    ++rate.total_num;
-    ++rate.error_num;
+    issue(id, true);
   }
 
   /**
@@ -67,7 +87,24 @@ struct ErrorRateManager
    */
   void issueSuccess(T const& id)
   {
-    ++errorRates[id].total_num;
+    issue(id, false);
+  }
+
+private:
+  void issue(T const& id, bool error)
+  {
+    auto& outcomes = errorRates[id].outcomes;
+    Clock::time_point const now = Clock::now();
+    outcomes.emplace_back(now, error);
+
+    // forget the outcomes that left the window
+    while (outcomes.front().first < now - window)
+    {
+      outcomes.pop_front();
+    }
   }
 };
+
+template <typename T>
+constexpr std::chrono::seconds ErrorRateManager<T>::window;
 }  // namespace detail
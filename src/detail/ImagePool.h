@@ -0,0 +1,107 @@
+/* Copyright 2018-2019 TomTom N.V.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License. */
+
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <utility>
+#include <QImage>
+#include <QSize>
+
+namespace detail
+{
+/**
+ * A pool of image buffers, so that decoding a tile doesn't need to allocate a new image.
+ *
+ * Tiles are decoded into images from the pool (see decodeTileImage()), and their images are returned to the pool when
+ * they are removed from the TileCache (see TileImage). Since all tiles of a tile server have the same size, the pool
+ * usually holds a matching buffer after the cache is full. The unused images are limited by maxFreeBytes, the least
+ * recently returned images are dropped first, so that the images of another tile size don't stay in the pool.
+ *
+ * @note This class is thread-safe.
+ */
+class ImagePool
+{
+public:
+  /// Max. host memory of the unused images in bytes, e.g. 64 tiles of 256 pixels or 4 tiles of 1024 pixels
+  static constexpr std::size_t maxFreeBytes = 16 * 1024 * 1024;
+
+  /**
+   * The pool shared by all tile caches
+   */
+  static ImagePool& instance()
+  {
+    static ImagePool pool;
+    return pool;
+  }
+
+  /**
+   * Take an unused image of the size @p size and the format @p format from the pool, or allocate a new one
+   */
+  QImage acquire(QSize const& size, QImage::Format format)
+  {
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      for (auto it = free.begin(); it != free.end(); ++it)
+      {
+        if (it->size() == size && it->format() == format)
+        {
+          QImage image = std::move(*it);
+          free.erase(it);
+          freeBytes -= static_cast<std::size_t>(image.byteCount());
+          return image;
+        }
+      }
+    }
+    return QImage(size, format);
+  }
+
+  /**
+   * Return the @p image to the pool. Null images and images that share their buffer with other images are ignored.
+   */
+  void release(QImage&& image)
+  {
+    // writing into a shared buffer would copy it anyway
+    if (image.isNull() || !image.isDetached())
+    {
+      return;
+    }
+
+    auto const bytes = static_cast<std::size_t>(image.byteCount());
+    if (bytes > maxFreeBytes)
+    {
+      return;
+    }
+
+    std::lock_guard<std::mutex> guard(lock);
+    while (freeBytes + bytes > maxFreeBytes)
+    {
+      freeBytes -= static_cast<std::size_t>(free.front().byteCount());
+      free.pop_front();
+    }
+    free.push_back(std::move(image));
+    freeBytes += bytes;
+  }
+
+private:
+  ImagePool() = default;
+
+  std::mutex lock;
+  /// the unused images, least recently returned first
+  std::deque<QImage> free;
+  std::size_t freeBytes{ 0 };
+};
+}  // namespace detail
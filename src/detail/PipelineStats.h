@@ -0,0 +1,120 @@
+/* Copyright 2018-2019 TomTom N.V.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License. */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+
+namespace detail
+{
+/**
+ * A histogram of latencies with exponentially growing buckets
+ *
+ * Bucket i counts the latencies below 2^i ms (and at least 2^(i-1) ms), the last bucket counts all longer latencies.
+ * Quantiles are therefore only accurate up to a factor of two, which is enough to tell which stage of the tile pipeline
+ * is slow.
+ */
+class LatencyHistogram
+{
+public:
+  using Duration = std::chrono::steady_clock::duration;
+
+  static constexpr std::size_t bucketCount = 16;
+
+  void add(Duration latency)
+  {
+    double const ms = std::chrono::duration<double, std::milli>(latency).count();
+    std::size_t bucket = 0;
+    while (bucket + 1 < bucketCount && ms >= static_cast<double>(1 << bucket))
+    {
+      ++bucket;
+    }
+
+    ++buckets_[bucket];
+    ++count_;
+    sumMs_ += ms;
+    maxMs_ = std::max(maxMs_, ms);
+  }
+
+  std::size_t count() const
+  {
+    return count_;
+  }
+
+  double meanMs() const
+  {
+    return count_ > 0 ? sumMs_ / count_ : 0.0;
+  }
+
+  double maxMs() const
+  {
+    return maxMs_;
+  }
+
+  /**
+   * The upper bound in ms of the bucket that contains the @p quantile (between 0 and 1) of the latencies, 0 if no
+   * latency was added yet. The bound of the last bucket is the max. latency.
+   */
+  double quantileMs(double quantile) const
+  {
+    auto const rank = static_cast<std::size_t>(quantile * count_);
+    std::size_t seen = 0;
+    for (std::size_t bucket = 0; bucket < bucketCount; ++bucket)
+    {
+      seen += buckets_[bucket];
+      if (seen > rank)
+      {
+        return bucket + 1 < bucketCount ? std::min(static_cast<double>(1 << bucket), maxMs_) : maxMs_;
+      }
+    }
+    return maxMs_;
+  }
+
+private:
+  std::array<std::size_t, bucketCount> buckets_{};
+  std::size_t count_{ 0 };
+  double sumMs_{ 0 };
+  double maxMs_{ 0 };
+};
+
+/**
+ * Timing and occupancy of the stages of a TileDownloader
+ *
+ * The latencies are measured from queueing the request of a tile until its data was received (per source), and from
+ * then until the tile was decoded.
+ */
+struct PipelineStats
+{
+  /// tiles downloaded from a tile server
+  LatencyHistogram web;
+  /// tiles read from the disk cache
+  LatencyHistogram disk;
+  /// tiles read from a tile pack
+  LatencyHistogram pack;
+  /// decoding on the worker threads, including the wait for a free thread
+  LatencyHistogram decode;
+
+  /// number of tiles waiting to be requested
+  std::size_t queued{ 0 };
+  /// number of requests in flight
+  std::size_t inFlight{ 0 };
+  /// number of tiles being decoded
+  std::size_t decoding{ 0 };
+  /// number of tiles waiting for a retry
+  std::size_t retrying{ 0 };
+};
+}  // namespace detail
@@ -0,0 +1,108 @@
+/* Copyright 2018-2019 TomTom N.V.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License. */
+
+#pragma once
+
+#include <QBuffer>
+#include <QByteArray>
+#include <QImage>
+#include <QImageReader>
+#include <stdexcept>
+#include <ros/console.h>
+#include "General.h"
+#include "VectorTile.h"
+#include "detail/ImagePool.h"
+
+namespace detail
+{
+/**
+ * Decode an encoded tile (e.g. PNG or JPEG) into a pixel buffer that can be uploaded to the GPU as-is.
+ *
+ * The returned image is a 32bit RGB image, see TileAtlas. Decoders of formats without alpha channel (e.g. JPEG)
+ * produce this format and decode directly into a buffer from the ImagePool, so usually no image is allocated or
+ * converted at all.
+ *
+ * @note This function is thread-safe. It is meant to be run on a worker thread, see TileDownloader.
+ * @return the decoded image or a null image if the data could not be decoded
+ */
+inline QImage decodeTileImage(QByteArray const& data)
+{
+  QBuffer buffer;
+  buffer.setData(data);
+  buffer.open(QIODevice::ReadOnly);
+
+  QImageReader reader(&buffer);
+  QSize const size = reader.size();
+  QImage image = size.isValid() ? ImagePool::instance().acquire(size, QImage::Format_RGB32) : QImage();
+  // reads into the given image if its size and format match the decoded image, otherwise allocates a new one
+  if (!reader.read(&image))
+  {
+    ImagePool::instance().release(std::move(image));
+    return QImage();
+  }
+
+  // the alpha channel is ignored by the atlas, so ARGB32 can be uploaded just like RGB32
+  if (image.format() == QImage::Format_RGB32 || image.format() == QImage::Format_ARGB32)
+  {
+    return image;
+  }
+
+  QImage converted = image.convertToFormat(QImage::Format_RGB32);
+  ImagePool::instance().release(std::move(image));
+  return converted;
+}
+
+/**
+ * Decode a vector tile (see parseVectorTile()) and rasterize it into a pixel buffer like decodeTileImage()
+ *
+ * @param tileSize the width/ height of the rendered image in pixels
+ * @note This function is thread-safe. It is meant to be run on a worker thread, see TileDownloader.
+ * @return the rendered image or a null image if the data could not be decoded
+ */
+inline QImage decodeVectorTile(QByteArray const& data, int tileSize = tileSizePx)
+{
+  try
+  {
+    return renderVectorTile(parseVectorTile(data), tileSize);
+  }
+  catch (std::runtime_error const& e)
+  {
+    ROS_ERROR_STREAM("Invalid vector tile: " << e.what());
+    return QImage();
+  }
+}
+
+/**
+ * Decode a raster or a vector tile into a pixel buffer
+ *
+ * @param vector whether the tile is known to be a vector tile, see isVectorTileUri(). Otherwise, the data is decoded as
+ * a vector tile if it isn't an image but looks like a vector tile, e.g. for tiles of a tile pack.
+ * @param tileSize the size of vector tiles in pixels, see decodeVectorTile(). Raster tiles keep their size.
+ */
+inline QImage decodeTile(QByteArray const& data, bool vector, int tileSize = tileSizePx)
+{
+  if (vector)
+  {
+    return decodeVectorTile(data, tileSize);
+  }
+
+  QImage image = decodeTileImage(data);
+  // a vector tile starts with the key of its first layer, i.e. field 3 with a length-delimited value
+  if (image.isNull() && !data.isEmpty() && data.at(0) == 0x1a)
+  {
+    image = decodeVectorTile(data, tileSize);
+  }
+  return image;
+}
+}  // namespace detail
@@ -0,0 +1,198 @@
+/* Copyright 2018-2019 TomTom N.V.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License. */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <limits>
+#include <mutex>
+#include <vector>
+
+#include <QDateTime>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QNetworkDiskCache>
+#include <QSet>
+#include <QString>
+#include <QUrl>
+
+namespace detail
+{
+/**
+ * Occupancy of a TileDiskCache
+ */
+struct DiskCacheStats
+{
+  /// number of cached tiles
+  std::size_t tiles;
+  /// size of the cached tiles in bytes
+  qint64 bytes;
+  /// number of tiles removed by the last eviction
+  std::size_t evicted;
+};
+
+/**
+ * A QNetworkDiskCache whose size limit and expiry are applied by evict(), which is meant to run on a worker thread.
+ *
+ * QNetworkDiskCache itself scans the whole cache directory when the cache is used first and whenever the cache exceeds
+ * its size limit, both on the thread which loads the tiles. This class disables that entirely: its estimated size is
+ * the result of the last evict().
+ */
+class TileDiskCache : public QNetworkDiskCache
+{
+public:
+  explicit TileDiskCache(QObject* parent = nullptr) : QNetworkDiskCache(parent)
+  {
+    // there is no option to disable maximum cache size
+    setMaximumCacheSize(std::numeric_limits<qint64>::max());
+  }
+
+  /**
+   * Read a cache entry and remember that it was used, see evict()
+   */
+  QIODevice* data(QUrl const& url) override
+  {
+    QIODevice* device = QNetworkDiskCache::data(url);
+    if (device)
+    {
+      std::lock_guard<std::mutex> lock(usedLock_);
+      used_.insert(url);
+    }
+    return device;
+  }
+
+  /**
+   * Remove all entries that are older than @p maxAge seconds (0 = no limit). Then, if the cache is larger than
+   * @p maxBytes, remove entries until it uses at most 90% of @p maxBytes, so that not every call has to remove entries.
+   *
+   * The files of the cache don't record when they were read, so the entries are removed in the order they were stored,
+   * and the entries which were used since this cache was created are removed last.
+   *
+   * @note This function is thread-safe, but it must not run concurrently with itself.
+   */
+  DiskCacheStats evict(qint64 maxBytes, qint64 maxAge)
+  {
+    struct File
+    {
+      QString path;
+      qint64 size;
+      QDateTime stored;
+    };
+    std::vector<File> files;
+    DiskCacheStats stats{ 0, 0, 0 };
+
+    QSet<QUrl> used;
+    {
+      std::lock_guard<std::mutex> lock(usedLock_);
+      used = used_;
+    }
+    // the used entries which were removed, so that `used_` doesn't grow without bound
+    QSet<QUrl> removed;
+    auto const remove = [this, &used, &removed](QString const& path, bool mayBeUsed) -> bool {
+      // reading the url costs a file access, so only do it if the entry may have been used
+      QUrl const url = mayBeUsed && !used.isEmpty() ? fileMetaData(path).url() : QUrl();
+      if (!QFile::remove(path))
+      {
+        return false;
+      }
+      if (used.contains(url))
+      {
+        removed.insert(url);
+      }
+      return true;
+    };
+
+    QDateTime const now = QDateTime::currentDateTimeUtc();
+    QDirIterator it(cacheDirectory(), { "*.d" }, QDir::Files, QDirIterator::Subdirectories);
+    while (it.hasNext())
+    {
+      it.next();
+      QFileInfo const info = it.fileInfo();
+      // skip the entries that QNetworkDiskCache is writing right now
+      if (info.dir().dirName() == "prepared")
+      {
+        continue;
+      }
+
+      if (maxAge > 0 && info.lastModified().secsTo(now) > maxAge)
+      {
+        stats.evicted += remove(info.filePath(), true) ? 1 : 0;
+        continue;
+      }
+
+      files.push_back({ info.filePath(), info.size(), info.lastModified() });
+      stats.bytes += info.size();
+    }
+    stats.tiles = files.size();
+
+    qint64 const target = maxBytes / 10 * 9;
+    if (stats.bytes > maxBytes)
+    {
+      std::sort(files.begin(), files.end(), [](File const& a, File const& b) { return a.stored < b.stored; });
+
+      // first pass: only entries which weren't used, second pass: all entries
+      for (int pass = 0; pass < 2 && stats.bytes > target; ++pass)
+      {
+        for (File& file : files)
+        {
+          if (stats.bytes <= target)
+          {
+            break;
+          }
+          if (file.path.isEmpty() || (pass == 0 && used.contains(fileMetaData(file.path).url())))
+          {
+            continue;
+          }
+
+          if (remove(file.path, pass > 0))
+          {
+            stats.bytes -= file.size;
+            --stats.tiles;
+            ++stats.evicted;
+          }
+          file.path.clear();
+        }
+      }
+    }
+
+    if (!removed.isEmpty())
+    {
+      std::lock_guard<std::mutex> lock(usedLock_);
+      used_.subtract(removed);
+    }
+
+    estimatedSize_ = stats.bytes;
+    return stats;
+  }
+
+protected:
+  /**
+   * Called by QNetworkDiskCache when the size of the cache is needed, which would scan the whole cache directory
+   */
+  qint64 expire() override
+  {
+    return estimatedSize_;
+  }
+
+private:
+  /// the urls of the entries that were read since the cache was created, except the ones that evict() removed
+  QSet<QUrl> used_;
+  std::mutex usedLock_;
+  std::atomic<qint64> estimatedSize_{ 0 };
+};
+}  // namespace detail
@@ -12,92 +12,430 @@ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 See the License for the specific language governing permissions and
 limitations under the License. */
 
+#include <algorithm>
+#include <chrono>
+#include <deque>
 #include <functional>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include <QDir>
 #include <QtCore>
 #include <QtNetwork>
 #include <QImage>
-#include <QImageReader>
+#include <QFutureWatcher>
+#include <QtConcurrentRun>
 #include <QStandardPaths>
 #include <QString>
 #include <QCryptographicHash>
 
 #include <ros/ros.h>
 
+#include <boost/optional.hpp>
+
 #include "detail/ErrorRateManager.h"
+#include "detail/PipelineStats.h"
+#include "detail/TileDiskCache.h"
+#include "detail/TileDecoder.h"
+#include "General.h"
 #include "TileId.h"
+#include "TilePack.h"
+#include "VectorTile.h"
 
 namespace detail
 {
+/**
+ * How the tiles of a tile server are requested
+ */
+struct TileServerSettings
+{
+  /// Max. number of parallel requests. Qt opens at most 6 connections per host, so more parallel requests only pay off
+  /// with HTTP/2 or with subdomains ({s}, see tileURL()).
+  std::size_t maxRequests = 6;
+  /// Whether to allow HTTP/2, which multiplexes all requests to a host over one connection
+  bool http2 = false;
+  /// Width/ height of the tiles in pixels, at which vector tiles are rendered
+  int tileSizePx = ::tileSizePx;
+};
+
+/**
+ * May a request that failed with @p error and the HTTP status @p httpStatus (0 if there was no response) succeed when
+ * it is repeated?
+ */
+inline bool isTransientError(QNetworkReply::NetworkError error, int httpStatus)
+{
+  // too many requests, or server errors
+  if (httpStatus == 429 || httpStatus >= 500)
+  {
+    return true;
+  }
+
+  switch (error)
+  {
+    case QNetworkReply::ConnectionRefusedError:
+    case QNetworkReply::RemoteHostClosedError:
+    case QNetworkReply::HostNotFoundError:
+    case QNetworkReply::TimeoutError:
+    case QNetworkReply::TemporaryNetworkFailureError:
+    case QNetworkReply::NetworkSessionFailedError:
+    case QNetworkReply::ProxyTimeoutError:
+    case QNetworkReply::UnknownNetworkError:
+      return true;
+    default:
+      return false;
+  }
+}
+
+/**
+ * The delay that the server asked for with the Retry-After header of @p reply, if any
+ */
+inline boost::optional<std::chrono::seconds> retryAfter(QNetworkReply const& reply)
+{
+  QByteArray const header = reply.rawHeader("Retry-After").trimmed();
+  if (header.isEmpty())
+  {
+    return boost::none;
+  }
+
+  // either a number of seconds or a HTTP date, e.g. "Wed, 21 Oct 2015 07:28:00 GMT"
+  bool ok = false;
+  int const seconds = header.toInt(&ok);
+  if (ok)
+  {
+    return std::chrono::seconds(std::max(0, seconds));
+  }
+
+  QDateTime date = QLocale::c().toDateTime(QString::fromLatin1(header), "ddd, dd MMM yyyy hh:mm:ss 'GMT'");
+  if (!date.isValid())
+  {
+    return boost::none;
+  }
+  date.setTimeSpec(Qt::UTC);
+  return std::chrono::seconds(std::max<qint64>(0, QDateTime::currentDateTimeUtc().secsTo(date)));
+}
+
 /**
  * @brief Tile downloader
  *
  * This class encapsulates away all the Qt stuff regarding downloading.
+ *
+ * Downloaded tiles are decoded on the global QThreadPool, so that the Qt main thread (which is also the render thread
+ * of rviz) only receives ready-to-upload images.
+ *
+ * The downloader schedules the requests itself: At most TileServerSettings::maxRequests requests per tile server are in
+ * flight, and the tiles are requested in the order of their priority. Requests of tiles that aren't wanted anymore are
+ * cancelled.
+ *
+ * Requests that failed with a transient error are repeated after an exponentially growing delay. If a tile server
+ * asks to pause with a Retry-After header, no requests are sent to it until then. If its error rate is high, only one
+ * request at a time is in flight.
+ *
+ * Tiles of a tile server with a tile pack URI (see isTilePackUri()) aren't requested at all, they are read from the
+ * pack without copying.
+ *
+ * One downloader can serve several clients, e.g. the tile caches of several displays which show different layers (see
+ * shared()). Then all clients share the connections, the disk cache and the scheduling: The wanted tiles of all clients
+ * are requested in turns, and a tile is only cancelled if no client wants it anymore.
  */
 class TileDownloader : public QObject
 {
   Q_OBJECT
+  using Clock = std::chrono::steady_clock;
+
   QNetworkAccessManager* manager;
-  std::function<void(TileId, QImage)> callback;
+  TileDiskCache* diskCache;
 
 public:
-  detail::ErrorRateManager<std::string> errorRates;
+  using Callback = std::function<void(TileId, QImage)>;
+  using ClientId = std::size_t;
 
-  TileDownloader(decltype(callback) callback) : manager(new QNetworkAccessManager(this)), callback(std::move(callback))
+private:
+  struct Client
+  {
+    /// receives the loaded tiles
+    Callback callback;
+    /// the wanted tiles in the order of their priority, see loadTiles()
+    std::vector<TileId> tiles;
+    /// the tiles in `tiles`
+    std::unordered_set<TileId> wanted;
+  };
+  std::map<ClientId, Client> clients;
+  ClientId nextClient{ 0 };
+
+  /// Tiles that wait to be requested, highest priority first
+  std::deque<TileId> queue;
+  /// The tiles in `queue`
+  std::unordered_set<TileId> queued;
+  /// Requested tiles and their replies
+  std::unordered_map<TileId, QNetworkReply*> inFlight;
+  /// The number of requests in `inFlight` per tile server
+  std::unordered_map<TileServer, std::size_t> inFlightPerServer;
+  std::unordered_map<TileServer, TileServerSettings> serverSettings;
+  /// Tiles whose reply finished and which are being decoded
+  std::unordered_set<TileId> decoding;
+  /// Tiles whose request failed, and when to request them again
+  std::unordered_map<TileId, Clock::time_point> retries;
+  /// The number of failed requests of the tiles that are retried
+  std::unordered_map<TileId, int> failures;
+  /// The tile servers that asked to pause the requests, and until when
+  std::unordered_map<TileServer, Clock::time_point> throttledUntil;
+  /// Calls wakeUp() when a retry is due or a pause ends
+  QTimer* wakeUpTimer;
+  /// The opened tile packs by their URI, null if the pack couldn't be opened
+  std::unordered_map<TileServer, std::shared_ptr<TilePack const>> packs;
+
+  /// Limits of the disk cache, see setDiskCacheLimits()
+  qint64 diskCacheMaxBytes{ std::numeric_limits<qint64>::max() };
+  qint64 diskCacheMaxAge{ 0 };
+  /// Periodically starts evictDiskCache()
+  QTimer* evictionTimer;
+  QFutureWatcher<DiskCacheStats> eviction;
+  /// Whether the limits changed while an eviction was running
+  bool evictAgain{ false };
+  boost::optional<DiskCacheStats> diskStats;
+  /// When the wanted tiles were queued first, until their data is received, see pipelineStats()
+  std::unordered_map<TileId, Clock::time_point> queuedAt;
+  PipelineStats pipeline;
+
+public:
+  detail::ErrorRateManager<TileServer> errorRates;
+
+  /// Interval of the disk cache eviction in ms
+  static constexpr int evictionInterval = 5 * 60 * 1000;
+  /// Max. number of requests of a tile, including the first one
+  static constexpr int maxAttempts = 5;
+  /// Delay of the first retry in ms, which doubles with every further retry
+  static constexpr int retryDelay = 1000;
+  /// Max. delay of a retry in ms
+  static constexpr int maxRetryDelay = 60 * 1000;
+  /// Above this error rate, at most one request per tile server is in flight
+  static constexpr float throttleErrorRate = 0.3;
+
+  TileDownloader()
+    : manager(new QNetworkAccessManager(this))
+    , diskCache(new TileDiskCache(this))
+    , wakeUpTimer(new QTimer(this))
+    , evictionTimer(new QTimer(this))
   {
     connect(manager, SIGNAL(finished(QNetworkReply*)), SLOT(downloadFinished(QNetworkReply*)));
 
-    QNetworkDiskCache* diskCache = new QNetworkDiskCache(this);
-    QString const cachePath =
-        QDir(QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation)).filePath("rviz_satellite");
-    diskCache->setCacheDirectory(cachePath);
-    // there is no option to disable maximum cache size
-    diskCache->setMaximumCacheSize(std::numeric_limits<qint64>::max());
+    diskCache->setCacheDirectory(cacheDirectory());
     manager->setCache(diskCache);
+
+    wakeUpTimer->setSingleShot(true);
+    connect(wakeUpTimer, &QTimer::timeout, this, &TileDownloader::wakeUp);
+
+    connect(evictionTimer, &QTimer::timeout, this, &TileDownloader::evictDiskCache);
+    connect(&eviction, &QFutureWatcherBase::finished, this, [this]() {
+      diskStats = eviction.result();
+      if (diskStats->evicted > 0)
+      {
+        ROS_DEBUG_STREAM_NAMED("rviz_satellite", "Removed " << diskStats->evicted << " tiles from the disk cache");
+      }
+      if (evictAgain)
+      {
+        evictAgain = false;
+        evictDiskCache();
+      }
+    });
+  }
+
+  ~TileDownloader() override
+  {
+    // the eviction uses the disk cache
+    eviction.waitForFinished();
   }
 
   /**
-   * @brief Load a specific tile
+   * The downloader shared by all tile caches of the process. It's created on demand and destroyed with its last user.
+   *
+   * @note Like the downloader itself, this function has to be called in the Qt main thread.
+   */
+  static std::shared_ptr<TileDownloader> shared()
+  {
+    static std::weak_ptr<TileDownloader> instance;
+    std::shared_ptr<TileDownloader> downloader = instance.lock();
+    if (!downloader)
+    {
+      downloader = std::make_shared<TileDownloader>();
+      instance = downloader;
+    }
+    return downloader;
+  }
+
+  /**
+   * Register a client, which receives its loaded tiles through @p callback
+   * @return the id of the client to pass to loadTiles()
+   */
+  ClientId addClient(Callback callback)
+  {
+    ClientId const id = nextClient++;
+    clients[id].callback = std::move(callback);
+    return id;
+  }
+
+  /**
+   * Unregister the client @p client and cancel the tiles which only it wanted
+   */
+  void removeClient(ClientId client)
+  {
+    clients.erase(client);
+    update();
+  }
+
+  /**
+   * Use the @p settings for requesting the tiles of @p tileServer
+   */
+  void setTileServerSettings(TileServer tileServer, TileServerSettings const& settings)
+  {
+    serverSettings[tileServer] = settings;
+    // more requests may be allowed now
+    dispatch();
+  }
+
+  /**
+   * The settings of @p tileServer, see setTileServerSettings()
+   */
+  TileServerSettings settingsOf(TileServer tileServer) const
+  {
+    auto const it = serverSettings.find(tileServer);
+    return it != serverSettings.end() ? it->second : TileServerSettings();
+  }
+
+  /**
+   * Did @p tileServer ask to pause the requests?
+   */
+  bool isThrottled(TileServer tileServer) const
+  {
+    auto const it = throttledUntil.find(tileServer);
+    return it != throttledUntil.end() && it->second > Clock::now();
+  }
+
+  /**
+   * Limit the disk cache to @p maxBytes and remove entries older than @p maxAge seconds (0 = no limit)
+   *
+   * The limits are applied on a worker thread right away and then periodically, not while tiles are loaded. Until the
+   * limits are set, the disk cache isn't limited.
+   */
+  void setDiskCacheLimits(qint64 maxBytes, qint64 maxAge)
+  {
+    diskCacheMaxBytes = maxBytes;
+    diskCacheMaxAge = maxAge;
+
+    evictionTimer->start(evictionInterval);
+    evictDiskCache();
+  }
+
+  /**
+   * The occupancy of the disk cache after the last eviction, none if no eviction finished yet
+   */
+  boost::optional<DiskCacheStats> const& diskCacheStats() const
+  {
+    return diskStats;
+  }
+
+  /**
+   * The latencies of the loaded tiles and the current number of tiles in each stage
+   */
+  PipelineStats pipelineStats() const
+  {
+    PipelineStats stats = pipeline;
+    stats.queued = queue.size();
+    stats.inFlight = inFlight.size();
+    stats.decoding = decoding.size();
+    stats.retrying = retries.size();
+    return stats;
+  }
+
+  /**
+   * The directory of the disk cache of the downloaded tiles
+   */
+  static QString cacheDirectory()
+  {
+    return QDir(QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation)).filePath("rviz_satellite");
+  }
+
+  /**
+   * @brief Load tiles
    *
    * Since QNetworkDiskCache is used, tiles will be loaded from the file system if they have been cached. Otherwise they
-   * get downloaded.
+   * get downloaded. Tiles of tile packs are read from the pack.
+   *
+   * The tiles of the client @p client are requested in the order of @p tiles, in turns with the tiles of the other
+   * clients. Every tile that was passed to a previous call of the client but not to this call is not wanted by the
+   * client anymore: If no other client wants it, its request is either dropped from the queue or cancelled, if it is
+   * in flight.
+   *
+   * A tile that is pending (see isPending()) is not requested again, instead the call attaches to the pending request.
    */
-  void loadTile(TileId const& tileId)
+  void loadTiles(ClientId client, std::vector<TileId> const& tiles)
   {
-    // see https://foundation.wikimedia.org/wiki/Maps_Terms_of_Use#Using_maps_in_third-party_services
-    auto const requestUrl = QUrl(QString::fromStdString(tileURL(tileId)));
-    ROS_DEBUG_STREAM_NAMED("rviz_satellite", "Loading tile " << requestUrl.toString().toStdString());
+    auto const it = clients.find(client);
+    if (it == clients.end())
+    {
+      return;
+    }
 
-    QNetworkRequest request(requestUrl);
-    char constexpr agent[] = "rviz_satellite/" RVIZ_SATELLITE_VERSION " (+https://github.com/gareth-cross/"
-                             "rviz_satellite)";
-    request.setHeader(QNetworkRequest::KnownHeaders::UserAgentHeader, agent);
-    QVariant variant;
-    variant.setValue(tileId);
-    request.setAttribute(QNetworkRequest::CacheLoadControlAttribute, QNetworkRequest::CacheLoadControl::PreferCache);
-    request.setAttribute(QNetworkRequest::User, variant);
-    manager->get(request);
+    it->second.tiles = tiles;
+    it->second.wanted = std::unordered_set<TileId>(tiles.begin(), tiles.end());
+    update();
+  }
+
+  /**
+   * Is the tile @p tileId queued, in flight, being decoded or waiting for a retry? Then it doesn't need to be requested
+   * again.
+   */
+  bool isPending(TileId const& tileId) const
+  {
+    return queued.find(tileId) != queued.end() || inFlight.find(tileId) != inFlight.end() ||
+           decoding.find(tileId) != decoding.end() || retries.find(tileId) != retries.end();
   }
 
 public slots:
   void downloadFinished(QNetworkReply* reply)
   {
+    reply->deleteLater();
+
     QVariant const variant = reply->request().attribute(QNetworkRequest::User);
     TileId const tileId = variant.value<TileId>();
 
     QUrl const url = reply->url();
+    auto const it = inFlight.find(tileId);
+    if (it != inFlight.end() && it->second == reply)
+    {
+      forgetRequest(it);
+    }
+
+    if (reply->error() == QNetworkReply::OperationCanceledError)
+    {
+      // the tile isn't wanted anymore, see loadTiles()
+      return;
+    }
+
     if (reply->error())
     {
       ROS_ERROR_STREAM("Got error when loading tile: " << reply->errorString().toStdString());
       errorRates.issueError(tileId.tileServer);
+      retryLater(tileId, *reply);
+      if (retries.find(tileId) == retries.end())
+      {
+        queuedAt.erase(tileId);
+      }
+      dispatch();
       return;
     }
     else
     {
       errorRates.issueSuccess(tileId.tileServer);
+      failures.erase(tileId);
     }
 
+    dispatch();
+
     // log if tile comes from cache or web
     bool const fromCache = reply->attribute(QNetworkRequest::SourceIsFromCacheAttribute).toBool();
     if (fromCache)
@@ -108,17 +446,403 @@ public slots:
     {
       ROS_DEBUG_STREAM_NAMED("rviz_satellite", "Loaded tile from web " << url.toString().toStdString());
     }
+    received(tileId, fromCache ? pipeline.disk : pipeline.web);
+
+    decode(tileId, url, reply->readAll());
+  }
 
-    QImageReader reader(reply);
-    if (!reader.canRead())
+private:
+  /**
+   * Apply the wanted tiles of all clients, see loadTiles()
+   */
+  void update()
+  {
+    // interleave the tiles of the clients, so that every client makes progress
+    std::vector<TileId> tiles;
+    std::unordered_set<TileId> wanted;
+    for (std::size_t i = 0;; ++i)
     {
-      ROS_ERROR_STREAM("Unable to decode image at " << reply->request().url().toString().toLatin1().data());
+      bool more = false;
+      for (auto const& client : clients)
+      {
+        std::vector<TileId> const& clientTiles = client.second.tiles;
+        if (i < clientTiles.size())
+        {
+          more = true;
+          if (wanted.insert(clientTiles[i]).second)
+          {
+            tiles.push_back(clientTiles[i]);
+          }
+        }
+      }
+      if (!more)
+      {
+        break;
+      }
+    }
+
+    for (auto it = inFlight.begin(); it != inFlight.end();)
+    {
+      if (wanted.find(it->first) == wanted.end())
+      {
+        // abort() emits finished() immediately, so the reply has to be removed first
+        QNetworkReply* reply = it->second;
+        it = forgetRequest(it);
+        ROS_DEBUG_STREAM_NAMED("rviz_satellite", "Cancelling tile " << reply->url().toString().toStdString());
+        reply->abort();
+      }
+      else
+      {
+        ++it;
+      }
+    }
+
+    // unwanted tiles aren't retried
+    for (auto it = retries.begin(); it != retries.end();)
+    {
+      it = wanted.find(it->first) != wanted.end() ? std::next(it) : retries.erase(it);
+    }
+    for (auto it = failures.begin(); it != failures.end();)
+    {
+      it = wanted.find(it->first) != wanted.end() ? std::next(it) : failures.erase(it);
+    }
+
+    queue.clear();
+    queued.clear();
+    Clock::time_point const now = Clock::now();
+    for (TileId const& tileId : tiles)
+    {
+      if (inFlight.find(tileId) == inFlight.end() && decoding.find(tileId) == decoding.end() &&
+          retries.find(tileId) == retries.end() && queued.insert(tileId).second)
+      {
+        queue.push_back(tileId);
+        // a tile that was queued before keeps its time
+        queuedAt.emplace(tileId, now);
+      }
+    }
+    for (auto it = queuedAt.begin(); it != queuedAt.end();)
+    {
+      it = wanted.find(it->first) != wanted.end() ? std::next(it) : queuedAt.erase(it);
+    }
+
+    // close the packs that aren't used anymore, so that a changed pack file is opened again
+    for (auto it = packs.begin(); it != packs.end();)
+    {
+      bool const used = std::any_of(tiles.begin(), tiles.end(),
+                                    [&it](TileId const& tileId) { return tileId.tileServer == it->first; });
+      it = used ? std::next(it) : packs.erase(it);
+    }
+
+    dispatch();
+  }
+
+  /**
+   * Apply the limits of the disk cache on a worker thread, see TileDiskCache::evict()
+   */
+  void evictDiskCache()
+  {
+    if (eviction.isRunning())
+    {
+      evictAgain = true;
       return;
     }
 
-    callback(tileId, reader.read());
+    qint64 const maxBytes = diskCacheMaxBytes;
+    qint64 const maxAge = diskCacheMaxAge;
+    TileDiskCache* cache = diskCache;
+    eviction.setFuture(QtConcurrent::run([cache, maxBytes, maxAge]() { return cache->evict(maxBytes, maxAge); }));
+  }
 
-    reply->deleteLater();
+  /**
+   * Request queued tiles until TileServerSettings::maxRequests requests per tile server are in flight
+   *
+   * Tiles of tile packs don't need a request, so they are read right away.
+   */
+  void dispatch()
+  {
+    // the limits only change when a request finishes
+    std::unordered_map<TileServer, std::size_t> limits;
+    for (auto it = queue.begin(); it != queue.end();)
+    {
+      TileId const tileId = *it;
+      bool const packed = isTilePackUri(tileId.tileServer.url());
+      auto limit = limits.find(tileId.tileServer);
+      if (limit == limits.end())
+      {
+        limit = limits.emplace(tileId.tileServer, requestLimit(tileId.tileServer)).first;
+      }
+
+      if (!packed && requestsInFlight(tileId.tileServer) >= limit->second)
+      {
+        // the tiles of other tile servers may still be requested
+        ++it;
+        continue;
+      }
+
+      it = queue.erase(it);
+      queued.erase(tileId);
+      if (packed)
+      {
+        loadPackedTile(tileId);
+      }
+      else
+      {
+        ++inFlightPerServer[tileId.tileServer];
+        inFlight.emplace(tileId, loadTile(tileId));
+      }
+    }
+  }
+
+  /**
+   * The max. number of requests to @p tileServer that may be in flight now
+   */
+  std::size_t requestLimit(TileServer tileServer)
+  {
+    auto const throttled = throttledUntil.find(tileServer);
+    if (throttled != throttledUntil.end())
+    {
+      if (throttled->second > Clock::now())
+      {
+        wakeUpAt(throttled->second);
+        return 0;
+      }
+      throttledUntil.erase(throttled);
+    }
+
+    if (errorRates.calculate(tileServer) > throttleErrorRate)
+    {
+      return 1;
+    }
+    return settingsOf(tileServer).maxRequests;
+  }
+
+  /**
+   * Schedule another request of the tile @p tileId whose @p reply failed, unless the error is permanent or the tile
+   * failed too often. Pause the requests to the tile server if the reply asks for it.
+   */
+  void retryLater(TileId const& tileId, QNetworkReply const& reply)
+  {
+    Clock::time_point const now = Clock::now();
+
+    auto const pause = retryAfter(reply);
+    if (pause)
+    {
+      Clock::time_point const until = now + *pause;
+      auto const inserted = throttledUntil.emplace(tileId.tileServer, until);
+      inserted.first->second = std::max(inserted.first->second, until);
+      ROS_WARN_STREAM_NAMED("rviz_satellite", "Tile server asked to pause the requests for " << pause->count() << "s");
+    }
+
+    int const status = reply.attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    int const attempts = ++failures[tileId];
+    if (!isTransientError(reply.error(), status) || attempts >= maxAttempts)
+    {
+      failures.erase(tileId);
+      return;
+    }
+
+    int const maxDelay = maxRetryDelay;
+    int const delay = std::min(maxDelay, retryDelay << (attempts - 1));
+    Clock::time_point const due = now + std::chrono::milliseconds(delay);
+    retries[tileId] = due;
+    wakeUpAt(due);
+    ROS_DEBUG_STREAM_NAMED("rviz_satellite", "Retrying tile " << tileURL(tileId) << " in " << delay << "ms (attempt "
+                                                               << attempts + 1 << ")");
+  }
+
+  /**
+   * Make sure that wakeUp() is called at @p time or earlier
+   */
+  void wakeUpAt(Clock::time_point time)
+  {
+    auto const delay = std::chrono::duration_cast<std::chrono::milliseconds>(time - Clock::now()).count();
+    int const ms = static_cast<int>(std::max<decltype(delay)>(0, delay));
+    if (!wakeUpTimer->isActive() || wakeUpTimer->remainingTime() > ms)
+    {
+      wakeUpTimer->start(ms);
+    }
+  }
+
+  /**
+   * Queue the tiles whose retry is due and request the tiles of tile servers whose pause ended
+   */
+  void wakeUp()
+  {
+    Clock::time_point const now = Clock::now();
+    for (auto it = retries.begin(); it != retries.end();)
+    {
+      if (it->second <= now)
+      {
+        // the tile was requested before all queued tiles
+        if (queued.insert(it->first).second)
+        {
+          queue.push_front(it->first);
+        }
+        it = retries.erase(it);
+      }
+      else
+      {
+        wakeUpAt(it->second);
+        ++it;
+      }
+    }
+
+    dispatch();
+  }
+
+  std::size_t requestsInFlight(TileServer tileServer) const
+  {
+    auto const it = inFlightPerServer.find(tileServer);
+    return it != inFlightPerServer.end() ? it->second : 0;
+  }
+
+  /**
+   * Remove the request @p it, which either finished or was cancelled, from `inFlight`
+   * @return the iterator following @p it
+   */
+  decltype(inFlight)::iterator forgetRequest(decltype(inFlight)::iterator it)
+  {
+    auto const count = inFlightPerServer.find(it->first.tileServer);
+    if (count != inFlightPerServer.end() && --count->second == 0)
+    {
+      inFlightPerServer.erase(count);
+    }
+    return inFlight.erase(it);
+  }
+
+  /**
+   * Read a specific tile from its tile pack and decode it
+   */
+  void loadPackedTile(TileId const& tileId)
+  {
+    auto it = packs.find(tileId.tileServer);
+    if (it == packs.end())
+    {
+      std::shared_ptr<TilePack const> pack;
+      try
+      {
+        pack = std::make_shared<TilePack>(QString::fromStdString(tilePackPath(tileId.tileServer.url())));
+      }
+      catch (std::runtime_error const& e)
+      {
+        ROS_ERROR_STREAM("Unable to load tile pack: " << e.what());
+      }
+      // don't try to open a broken pack again for every tile
+      it = packs.emplace(tileId.tileServer, std::move(pack)).first;
+    }
+
+    QUrl const url(QString::fromStdString(tileURL(tileId)));
+    QByteArray const data = it->second ? it->second->tile(tileId.coord, tileId.zoom) : QByteArray();
+    if (data.isNull())
+    {
+      ROS_DEBUG_STREAM_NAMED("rviz_satellite", "Tile " << tileId.zoom << "/" << tileId.coord.x << "/" << tileId.coord.y
+                                                       << " is not in the tile pack " << tileId.tileServer);
+      // a pack may only cover parts of the map, so a missing tile is a miss, but a broken pack is an error
+      if (!it->second)
+      {
+        errorRates.issueError(tileId.tileServer);
+      }
+      queuedAt.erase(tileId);
+      return;
+    }
+
+    errorRates.issueSuccess(tileId.tileServer);
+    ROS_DEBUG_STREAM_NAMED("rviz_satellite", "Loaded tile from pack " << url.toString().toStdString());
+    received(tileId, pipeline.pack);
+    // the data refers to the mapped pack, so the pack has to outlive the decoding
+    decode(tileId, url, data, it->second);
+  }
+
+  /**
+   * Request a specific tile
+   */
+  QNetworkReply* loadTile(TileId const& tileId)
+  {
+    // see https://foundation.wikimedia.org/wiki/Maps_Terms_of_Use#Using_maps_in_third-party_services
+    auto const requestUrl = QUrl(QString::fromStdString(tileURL(tileId)));
+    ROS_DEBUG_STREAM_NAMED("rviz_satellite", "Loading tile " << requestUrl.toString().toStdString());
+
+    QNetworkRequest request(requestUrl);
+    char constexpr agent[] = "rviz_satellite/" RVIZ_SATELLITE_VERSION " (+https://github.com/gareth-cross/"
+                             "rviz_satellite)";
+    request.setHeader(QNetworkRequest::KnownHeaders::UserAgentHeader, agent);
+    QVariant variant;
+    variant.setValue(tileId);
+    request.setAttribute(QNetworkRequest::CacheLoadControlAttribute, QNetworkRequest::CacheLoadControl::PreferCache);
+#if QT_VERSION >= QT_VERSION_CHECK(5, 15, 0)
+    request.setAttribute(QNetworkRequest::Http2AllowedAttribute, settingsOf(tileId.tileServer).http2);
+#else
+    request.setAttribute(QNetworkRequest::HTTP2AllowedAttribute, settingsOf(tileId.tileServer).http2);
+#endif
+    request.setAttribute(QNetworkRequest::User, variant);
+    return manager->get(request);
+  }
+
+  /**
+   * Pass the loaded tile @p tileId to the clients which want it. If no client wants it anymore, e.g. because it was
+   * still decoding when its area was left, it's dropped, so that it doesn't take the memory of the other clients.
+   */
+  void deliver(TileId const& tileId, QImage const& image)
+  {
+    // a callback may remove a client
+    std::vector<Callback> callbacks;
+    for (auto const& client : clients)
+    {
+      if (client.second.wanted.find(tileId) != client.second.wanted.end())
+      {
+        callbacks.push_back(client.second.callback);
+      }
+    }
+
+    for (Callback const& callback : callbacks)
+    {
+      callback(tileId, image);
+    }
+  }
+
+  /**
+   * Record the latency from queueing the tile @p tileId until its data was received in @p histogram
+   */
+  void received(TileId const& tileId, LatencyHistogram& histogram)
+  {
+    auto const it = queuedAt.find(tileId);
+    if (it != queuedAt.end())
+    {
+      histogram.add(Clock::now() - it->second);
+      queuedAt.erase(it);
+    }
+  }
+
+  /**
+   * Decode the image @p data of a tile in a worker thread and pass the result to the clients in this thread
+   *
+   * @param owner is kept alive until the @p data is decoded, if the data doesn't own its memory
+   */
+  void decode(TileId const& tileId, QUrl const& url, QByteArray const& data,
+              std::shared_ptr<void const> const& owner = nullptr)
+  {
+    decoding.insert(tileId);
+    Clock::time_point const started = Clock::now();
+
+    auto* watcher = new QFutureWatcher<QImage>(this);
+    connect(watcher, &QFutureWatcherBase::finished, this, [this, watcher, tileId, url, started]() {
+      watcher->deleteLater();
+      decoding.erase(tileId);
+      pipeline.decode.add(Clock::now() - started);
+
+      QImage image = watcher->result();
+      if (image.isNull())
+      {
+        ROS_ERROR_STREAM("Unable to decode image at " << url.toString().toStdString());
+        return;
+      }
+
+      deliver(tileId, std::move(image));
+    });
+    bool const vector = isVectorTileUri(tileId.tileServer.url());
+    int const tileSize = settingsOf(tileId.tileServer).tileSizePx;
+    watcher->setFuture(
+        QtConcurrent::run([data, owner, vector, tileSize]() { return detail::decodeTile(data, vector, tileSize); }));
   }
 };
 
@@ -0,0 +1,339 @@
+/* Copyright 2018-2019 TomTom N.V.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License. */
+
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <unordered_set>
+#include <vector>
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QNetworkDiskCache>
+#include <QStringList>
+#include <QTimer>
+
+#include "Area.h"
+#include "Coordinates.h"
+#include "General.h"
+#include "Route.h"
+#include "TileId.h"
+#include "TilePack.h"
+#include "detail/TileDownloader.h"
+
+/**
+ * @file
+ * Command line tool that loads all tiles of a bounding box or along the route of a bag file into the disk cache of
+ * rviz_satellite, and optionally into a tile pack, so that the map is available without connectivity.
+ *
+ * The tiles are loaded with the same detail::TileDownloader that the display uses, so they end up in the same cache.
+ */
+
+namespace
+{
+/**
+ * Order of the tiles: by zoom level, then row-major
+ */
+struct TileOrder
+{
+  bool operator()(TileId const& a, TileId const& b) const
+  {
+    return std::tie(a.zoom, a.coord.y, a.coord.x) < std::tie(b.zoom, b.coord.y, b.coord.x);
+  }
+};
+
+using TileSet = std::set<TileId, TileOrder>;
+
+/**
+ * Parse "<min>" or "<min>:<max>" into a range of zoom levels
+ */
+std::pair<int, int> parseZoomRange(QString const& text)
+{
+  QStringList const parts = text.split(':');
+  bool okMin = false;
+  bool okMax = false;
+  int const min = parts.front().toInt(&okMin);
+  int const max = parts.size() == 2 ? parts.back().toInt(&okMax) : min;
+  if (!okMin || (parts.size() == 2 && !okMax) || parts.size() > 2 || min < 0 || max < min || max > maxZoom)
+  {
+    throw std::invalid_argument("Invalid zoom range '" + text.toStdString() + "', expected 0 <= min[:max] <= " +
+                                std::to_string(maxZoom));
+  }
+  return { min, max };
+}
+
+/**
+ * Parse "<lat_min>,<lon_min>,<lat_max>,<lon_max>" into the south-west and north-east corners of a bounding box
+ */
+std::pair<WGSCoordinate, WGSCoordinate> parseBoundingBox(QString const& text)
+{
+  QStringList const parts = text.split(',');
+  std::vector<double> values;
+  for (QString const& part : parts)
+  {
+    bool ok = false;
+    values.push_back(part.toDouble(&ok));
+    if (!ok)
+    {
+      break;
+    }
+  }
+
+  if (parts.size() != 4 || values.size() != 4 || values[0] > values[2] || values[1] > values[3])
+  {
+    throw std::invalid_argument("Invalid bounding box '" + text.toStdString() +
+                                "', expected lat_min,lon_min,lat_max,lon_max");
+  }
+  return { { values[0], values[1] }, { values[2], values[3] } };
+}
+
+/**
+ * Add all tiles of the bounding box between @p southWest and @p northEast at @p zoom to @p tiles
+ */
+void addBoundingBoxTiles(TileServer tileServer, WGSCoordinate const& southWest, WGSCoordinate const& northEast,
+                         int zoom, TileSet& tiles)
+{
+  // the tile y coordinate grows southwards
+  auto const leftTop = fromWGSCoordinate({ northEast.lat, southWest.lon }, zoom);
+  auto const rightBottom = fromWGSCoordinate({ southWest.lat, northEast.lon }, zoom);
+  for (int x = leftTop.x; x <= rightBottom.x; ++x)
+  {
+    for (int y = leftTop.y; y <= rightBottom.y; ++y)
+    {
+      tiles.insert({ tileServer, { x, y }, zoom });
+    }
+  }
+}
+
+/**
+ * Loads tiles with a detail::TileDownloader at a limited rate and quits the application when all tiles are either
+ * loaded or failed
+ */
+class TileSeeder
+{
+public:
+  /**
+   * @param rate max. number of tiles that are requested per second
+   */
+  TileSeeder(std::vector<TileId> tiles, double rate, TileServer tileServer,
+             detail::TileServerSettings const& settings)
+    : tiles_(std::move(tiles))
+    , maxRequests_(settings.maxRequests)
+    , client_(downloader_.addClient([this](TileId tileId, QImage) { loaded_.insert(std::move(tileId)); }))
+  {
+    downloader_.setTileServerSettings(tileServer, settings);
+    timer_.setInterval(std::max(1, static_cast<int>(1000 / rate)));
+    QObject::connect(&timer_, &QTimer::timeout, [this]() { step(); });
+  }
+
+  void start()
+  {
+    timer_.start();
+  }
+
+  /**
+   * The tiles that were loaded successfully
+   */
+  std::unordered_set<TileId> const& loaded() const
+  {
+    return loaded_;
+  }
+
+private:
+  /**
+   * Request the next tile, unless the downloader is busy
+   */
+  void step()
+  {
+    // requests that aren't pending anymore either succeeded or failed
+    for (auto it = pending_.begin(); it != pending_.end();)
+    {
+      it = downloader_.isPending(*it) ? std::next(it) : pending_.erase(it);
+    }
+
+    if (next_ < tiles_.size() && pending_.size() < maxRequests_)
+    {
+      pending_.insert(tiles_[next_++]);
+      // the downloader cancels the tiles that aren't passed, so pass all pending ones
+      downloader_.loadTiles(client_, std::vector<TileId>(pending_.begin(), pending_.end()));
+
+      if (next_ % 100 == 0 || next_ == tiles_.size())
+      {
+        std::cout << "Requested " << next_ << " of " << tiles_.size() << " tiles" << std::endl;
+      }
+    }
+    else if (next_ == tiles_.size() && pending_.empty())
+    {
+      timer_.stop();
+      QCoreApplication::quit();
+    }
+  }
+
+  std::vector<TileId> tiles_;
+  /// index of the next tile to request
+  std::size_t next_{ 0 };
+  std::size_t maxRequests_;
+  std::unordered_set<TileId> pending_;
+  std::unordered_set<TileId> loaded_;
+  QTimer timer_;
+  detail::TileDownloader downloader_;
+  detail::TileDownloader::ClientId client_;
+};
+
+/**
+ * Write the @p tiles from the disk cache of the TileDownloader into a tile pack at @p path
+ * @return the number of written tiles
+ */
+std::size_t writePack(std::unordered_set<TileId> const& tiles, QString const& path)
+{
+  QNetworkDiskCache cache;
+  cache.setCacheDirectory(detail::TileDownloader::cacheDirectory());
+
+  TilePackWriter writer;
+  for (TileId const& tileId : tiles)
+  {
+    std::unique_ptr<QIODevice> data(cache.data(QUrl(QString::fromStdString(tileURL(tileId)))));
+    if (!data)
+    {
+      std::cerr << "Tile " << tileURL(tileId) << " is not in the cache, the server may forbid caching it" << std::endl;
+      continue;
+    }
+    writer.add(tileId.coord, tileId.zoom, data->readAll());
+  }
+
+  writer.write(path);
+  return writer.tileCount();
+}
+}  // namespace
+
+int main(int argc, char** argv)
+{
+  QCoreApplication app(argc, argv);
+  QCoreApplication::setApplicationName("seed_tiles");
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription("Load the tiles of a bounding box or along the route of a bag file into the tile "
+                                   "cache of rviz_satellite.");
+  parser.addHelpOption();
+
+  QCommandLineOption const urlOption({ "u", "url" }, "Tile URL (Object URI) of the tile server.", "url");
+  QCommandLineOption const zoomOption({ "z", "zoom" }, "Zoom level or range of zoom levels, e.g. 16:19.", "min[:max]");
+  QCommandLineOption const bboxOption("bbox", "Bounding box to load.", "lat_min,lon_min,lat_max,lon_max");
+  QCommandLineOption const bagOption("bag", "Bag file with sensor_msgs/NavSatFix messages along whose route to load.",
+                                     "file");
+  QCommandLineOption const topicOption("topic", "NavSatFix topic in the bag file (default: all NavSatFix topics).",
+                                       "topic");
+  QCommandLineOption const blocksOption("blocks", "Adjacent blocks to load around every position of the route.",
+                                        "blocks", "3");
+  QCommandLineOption const rateOption("rate", "Max. number of tiles requested per second. Respect the usage policy of "
+                                              "the tile server!",
+                                      "tiles", "2");
+  QCommandLineOption const maxRequestsOption("max-requests", "Max. number of parallel requests.", "requests", "6");
+  QCommandLineOption const http2Option("http2", "Allow HTTP/2.");
+  QCommandLineOption const packOption("pack", "Also write the loaded tiles into a tile pack.", "file");
+  parser.addOptions(
+      { urlOption, zoomOption, bboxOption, bagOption, topicOption, blocksOption, rateOption, maxRequestsOption,
+        http2Option, packOption });
+  parser.process(app);
+
+  try
+  {
+    std::string const url = parser.value(urlOption).toStdString();
+    if (url.empty() || isTilePackUri(url))
+    {
+      throw std::invalid_argument("A tile server URL is required, see --help");
+    }
+    TileServer const tileServer(url);
+    if (parser.isSet(bboxOption) == parser.isSet(bagOption))
+    {
+      throw std::invalid_argument("Either a bounding box or a bag file is required, see --help");
+    }
+
+    auto const zoomRange = parseZoomRange(parser.value(zoomOption));
+    bool okRate = false;
+    double const rate = parser.value(rateOption).toDouble(&okRate);
+    if (!okRate || rate <= 0)
+    {
+      throw std::invalid_argument("The rate has to be positive");
+    }
+
+    detail::TileServerSettings settings;
+    bool okRequests = false;
+    int const maxRequests = parser.value(maxRequestsOption).toInt(&okRequests);
+    if (!okRequests || maxRequests <= 0)
+    {
+      throw std::invalid_argument("The number of parallel requests has to be positive");
+    }
+    settings.maxRequests = static_cast<std::size_t>(maxRequests);
+    settings.http2 = parser.isSet(http2Option);
+
+    TileSet tiles;
+    if (parser.isSet(bboxOption))
+    {
+      auto const bbox = parseBoundingBox(parser.value(bboxOption));
+      for (int zoom = zoomRange.first; zoom <= zoomRange.second; ++zoom)
+      {
+        addBoundingBoxTiles(tileServer, bbox.first, bbox.second, zoom, tiles);
+      }
+    }
+    else
+    {
+      bool okBlocks = false;
+      int const blocks = parser.value(blocksOption).toInt(&okBlocks);
+      if (!okBlocks)
+      {
+        throw std::invalid_argument("Invalid number of blocks");
+      }
+
+      std::vector<WGSCoordinate> const route =
+          readRoute(parser.value(bagOption).toStdString(), parser.value(topicOption).toStdString());
+      std::cout << "Read " << route.size() << " positions from the bag file" << std::endl;
+      for (WGSCoordinate const& position : route)
+      {
+        for (int zoom = zoomRange.first; zoom <= zoomRange.second; ++zoom)
+        {
+          Area const area({ tileServer, fromWGSCoordinate(position, zoom), zoom }, blocks);
+          std::vector<TileId> const areaTiles = areaTilesCenterOut(area);
+          tiles.insert(areaTiles.begin(), areaTiles.end());
+        }
+      }
+    }
+
+    std::cout << "Loading " << tiles.size() << " tiles" << std::endl;
+    TileSeeder seeder({ tiles.begin(), tiles.end() }, rate, tileServer, settings);
+    seeder.start();
+    app.exec();
+
+    std::size_t const failed = tiles.size() - seeder.loaded().size();
+    std::cout << "Loaded " << seeder.loaded().size() << " tiles, " << failed << " failed" << std::endl;
+
+    if (parser.isSet(packOption))
+    {
+      std::size_t const written = writePack(seeder.loaded(), parser.value(packOption));
+      std::cout << "Wrote " << written << " tiles into " << parser.value(packOption).toStdString() << std::endl;
+    }
+
+    return failed == 0 ? 0 : 1;
+  }
+  catch (std::exception const& e)
+  {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+}